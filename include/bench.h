@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 性能基准测试（timemachineplus bench <类型> <路径>）
+namespace Bench
+{
+// 用不同线程数扫描 path，输出每秒文件数，用于观察扫描随核数/队列深度的扩展情况
+int scan(const std::string& path);
+
+// 在 dir 下生成 4KB 到 maxBytes 的各档测试文件，输出每档各摘要算法的 GB/s（另测 mmap 读取的 MD5）
+int hash(const std::string& dir, uint64_t maxBytes);
+
+// 对 path 下的全部文件按内容分块（不写入），输出按整个文件和按块去重后的数据量、去重比及吞吐；
+// avgBytes 为 0 时使用 store.chunk_avg_kb
+int chunk(const std::string& path, std::size_t avgBytes);
+
+// 在 dir 下生成 size 字节的文件及其原地修改后的新版本，比较完整拷贝与差量保存
+// 写入的字节数和耗时，并核对应用补丁的结果
+int delta(const std::string& dir, uint64_t size);
+
+// 在 dir 下比较逐个同步拷贝（CopyEngine）与 io_uring 批量拷贝：smallFiles 个 8KB 文件和
+// 4 个 64MB 文件，输出每秒文件数和 MB/s，并核对两种方式的摘要一致
+int copy(const std::string& dir, std::size_t smallFiles);
+}  // namespace Bench
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <string>
+
+// 备份、清理、恢复中的热点查询。ServiceRun 与 SchemaMigration::checkQueryPlans 共用同一份 SQL，
+// 保证被检查执行计划的就是实际运行的语句
+namespace CatalogQueries
+{
+// 某个备份来源下路径大于给定值的文件及各自最新版本，按 filepath 排序（参数：backuprootid, filepath）。
+// 最新版本信息直接取自 tb_backfiles 上的冗余列，不访问版本表
+inline const std::string latestVersionsByRoot =
+    "select id,filepath,lasthistoryid as historyid,lastmotifytime as motifytime,"
+    "lastfilesize as filesize,lastmd5 as md5,lasthashalgo as hashalgo,"
+    "lastsampledigest as sampledigest,lastsamplekb as samplekb "
+    "from tb_backfiles where backuprootid=? and filepath>? order by filepath";
+
+// 新增版本后更新文件的最新版本信息
+// （参数：historyid, motifytime, filesize, 摘要, 摘要算法, 抽样摘要, 抽样 KB, 备份时间, backupfileid）
+inline const std::string setCurrentVersion =
+    "update tb_backfiles set lasthistoryid=?,lastmotifytime=?,lastfilesize=?,lastmd5=?,"
+    "lasthashalgo=?,lastsampledigest=?,lastsamplekb=?,lastbackuptime=?,"
+    "versionhistorycnt=coalesce(versionhistorycnt,0)+1 where id=?";
+
+// 删除版本后按版本表重新计算文件的最新版本信息和版本数（后接 where 条件）
+inline const std::string refreshCurrentVersions =
+    "update tb_backfiles set "
+    "(lasthistoryid,lastmotifytime,lastfilesize,lastmd5,lasthashalgo,lastsampledigest,"
+    "lastsamplekb,lastbackuptime)="
+    "(select id,motifytime,filesize,md5,hashalgo,sampledigest,samplekb,copyendtime "
+    "from tb_backfilehistory "
+    "where backupfileid=tb_backfiles.id order by id desc limit 1),"
+    "versionhistorycnt=(select count(*) from tb_backfilehistory "
+    "where backupfileid=tb_backfiles.id)";
+
+// 重新计算单个文件（参数：backupfileid）
+inline const std::string refreshCurrentVersion = refreshCurrentVersions + " where id=?";
+
+// 某个备份来源下的全部文件 id（参数：backuprootid）
+inline const std::string fileIdsByRoot = "select id from tb_backfiles where backuprootid=?";
+
+// 某个文件的全部版本（参数：backupfileid）
+inline const std::string historyByFile =
+    "select id,backuptargetrootid,backuptargetpath,storage from tb_backfilehistory "
+    "where backupfileid=?";
+
+// 恢复时列出某个源文件的全部版本（参数：filepath）
+inline const std::string restoreVersions =
+    "select tb_backfilehistory.id,tb_backfilehistory.motifytime,tb_backfilehistory.filesize,"
+    "md5,hashalgo,storage,backuptargetpath,targetrootpath "
+    "from tb_backfilehistory, tb_backfiles, tb_backuptargetroot "
+    "where tb_backfilehistory.backupfileid = tb_backfiles.id "
+    "and tb_backfilehistory.backuptargetrootid = tb_backuptargetroot.id "
+    "and tb_backfiles.filepath = ?";
+
+// 树形摘要版本的各块摘要（参数：historyid, chunkindex, digest）
+inline const std::string insertChunkDigest =
+    "insert into tb_backfilechunks (historyid,chunkindex,digest) values (?,?,?)";
+
+// 某个版本的各块摘要，按块顺序（参数：historyid）
+inline const std::string chunkDigestsByHistory =
+    "select chunkindex,digest from tb_backfilechunks where historyid=? order by chunkindex";
+
+// 删除版本时一并删除（参数：historyid）
+inline const std::string deleteChunkDigests = "delete from tb_backfilechunks where historyid=?";
+
+// 源文件摘要缓存：设备号、inode、大小、修改时间、ctime 与算法全部一致才算命中
+// （参数：device, inode, filesize, motifytime, changetime, hashalgo）
+inline const std::string cachedDigest =
+    "select digest from tb_hashcache where device=? and inode=? and filesize=? "
+    "and motifytime=? and changetime=? and hashalgo=?";
+
+// 参数：device, inode, filesize, motifytime, changetime, hashalgo, digest, cachedat
+inline const std::string storeCachedDigest =
+    "insert or replace into tb_hashcache "
+    "(device,inode,filesize,motifytime,changetime,hashalgo,digest,cachedat) "
+    "values (?,?,?,?,?,?,?,?)";
+
+// 删除早于指定时间写入的缓存（参数：cachedat）
+inline const std::string pruneDigestCache = "delete from tb_hashcache where cachedat<?";
+
+// 内容寻址的对象（tb_objects）。是否已有同样大小的对象（参数：filesize, hashalgo）
+inline const std::string objectSizeExists =
+    "select 1 from tb_objects where filesize=? and hashalgo=? limit 1";
+
+// 按内容查找对象（参数：filesize, hashalgo, digest）
+inline const std::string findObject =
+    "select id,backuptargetrootid,backuptargetpath from tb_objects "
+    "where filesize=? and hashalgo=? and digest=? and refcount>0";
+
+// 参数：backuptargetrootid, backuptargetpath, filesize, hashalgo, digest
+inline const std::string insertObject =
+    "insert into tb_objects (backuptargetrootid,backuptargetpath,filesize,hashalgo,digest,refcount) "
+    "values (?,?,?,?,?,1)";
+
+// 参数：id
+inline const std::string addObjectRef = "update tb_objects set refcount=refcount+1 where id=?";
+
+// 删除版本时减少引用（参数：backuptargetrootid, backuptargetpath）
+inline const std::string releaseObject =
+    "update tb_objects set refcount=refcount-1 where backuptargetrootid=? and backuptargetpath=?";
+
+// 参数：backuptargetrootid, backuptargetpath
+inline const std::string objectByPath =
+    "select id,refcount,filesize,hashalgo,digest from tb_objects "
+    "where backuptargetrootid=? and backuptargetpath=?";
+
+// 参数：id
+inline const std::string deleteObject = "delete from tb_objects where id=?";
+
+// 按块保存的版本的块清单（参数：historyid, chunkindex, objectid, chunksize）
+inline const std::string insertManifestChunk =
+    "insert into tb_manifestchunks (historyid,chunkindex,objectid,chunksize) values (?,?,?,?)";
+
+// 某个版本的各块及所在对象，按块顺序（参数：historyid）
+inline const std::string manifestByHistory =
+    "select m.chunksize,o.id as objectid,o.backuptargetrootid,o.backuptargetpath,o.filesize,o.hashalgo,"
+    "o.digest from tb_manifestchunks m join tb_objects o on o.id=m.objectid "
+    "where m.historyid=? order by m.chunkindex";
+
+// 恢复、校验时沿追加版本找到完整版本（参数：historyid）
+inline const std::string versionStorage =
+    "select id,filesize,storage,basehistoryid,chaindepth,backuptargetrootid,backuptargetpath "
+    "from tb_backfilehistory where id=?";
+
+// 参数：historyid
+inline const std::string deleteManifest = "delete from tb_manifestchunks where historyid=?";
+
+// 文件最新版本的差量签名，签名所属版本已不是最新版本时不返回（参数：backupfileid）
+inline const std::string deltaBasis =
+    "select s.historyid,s.signature,h.chaindepth from tb_signatures s "
+    "join tb_backfiles f on f.id=s.backupfileid and f.lasthistoryid=s.historyid "
+    "join tb_backfilehistory h on h.id=s.historyid where s.backupfileid=?";
+
+// 每个文件只保留一个签名（参数：backupfileid, historyid, signature）
+inline const std::string storeSignature =
+    "insert or replace into tb_signatures (backupfileid,historyid,signature) values (?,?,?)";
+
+// 参数：historyid
+inline const std::string deleteSignature = "delete from tb_signatures where historyid=?";
+
+// 按 id 分批遍历目标上的对象，用于迁移目录布局（参数：backuptargetrootid, 上一批最后的 id, 批大小）。
+// +backuptargetrootid 使其不走 idx_objects_path，按主键顺序取，不必为排序读出该目标的全部对象
+inline const std::string objectsByTarget =
+    "select id,backuptargetpath from tb_objects where +backuptargetrootid=? and id>? "
+    "order by id limit ?";
+
+// 参数：backuptargetpath, id
+inline const std::string moveObject = "update tb_objects set backuptargetpath=? where id=?";
+
+// 引用该对象的版本随之修改（参数：新 backuptargetpath, backuptargetrootid, 原 backuptargetpath）
+inline const std::string moveObjectVersions =
+    "update tb_backfilehistory set backuptargetpath=? "
+    "where backuptargetrootid=? and backuptargetpath=?";
+}  // namespace CatalogQueries
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// 内容定义分块（FastCDC）：用 gear 滚动哈希寻找切分点，文件中间插入或删除数据只影响附近的块，
+// 其余块的边界和内容不变，可以按块去重。块长度在 [minSize, maxSize] 之间，平均约为 avgSize：
+// 前 minSize 字节不检查切分点；未到平均长度时用更严格的掩码，超过后用更宽松的掩码（归一化分块），
+// 使块长度集中在平均值附近。gear 表固定，同样的内容在任何版本中都得到同样的切分
+class Chunker
+{
+   public:
+    // 回调收到的块数据在回调返回后失效
+    using Sink = std::function<void(const unsigned char* data, std::size_t size)>;
+
+    // avgSize 向下取 2 的幂（至少 4KB）；minSize = avgSize / 4，maxSize = avgSize * 4
+    explicit Chunker(std::size_t avgSize);
+
+    // 按 timemachine.conf 中的 store.chunk_avg_kb（默认 1024）创建
+    static Chunker configured();
+
+    // data 中第一个块的长度。调用方保证 size 不小于 maxSize，或者 data 已是剩余的全部内容
+    std::size_t cut(const unsigned char* data, std::size_t size) const;
+
+    // 顺序读取文件并逐块回调，返回块数；打开或读取失败时抛出异常
+    std::size_t split(const std::string& path, const Sink& sink) const;
+
+    std::size_t minSize() const noexcept { return m_minSize; }
+    std::size_t avgSize() const noexcept { return m_avgSize; }
+    std::size_t maxSize() const noexcept { return m_maxSize; }
+
+   private:
+    std::size_t m_minSize;
+    std::size_t m_avgSize;
+    std::size_t m_maxSize;
+    uint64_t m_maskSmall;  // 未到平均长度时使用，比平均值多 2 位
+    uint64_t m_maskLarge;  // 超过平均长度后使用，比平均值少 2 位
+};
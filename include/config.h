@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+// 运行参数：从当前目录的 timemachine.conf 读取（每行 key=value，# 开头为注释）
+// 文件不存在时全部使用默认值
+class Config
+{
+   public:
+    explicit Config(const std::string& fileName = "timemachine.conf");
+
+    // 进程内共享的配置实例
+    static const Config& instance();
+
+    std::string getString(const std::string& key, const std::string& def = "") const;
+    int64_t getInt(const std::string& key, int64_t def = 0) const;
+    bool getBool(const std::string& key, bool def = false) const;
+
+   private:
+    std::map<std::string, std::string> m_values;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+class Digest;
+
+// 备份文件拷贝引擎，按从快到慢的顺序选择拷贝方式：
+//   clone            FICLONE 引用同一份数据（btrfs、XFS 等写时复制文件系统），只写元数据
+//   copy_file_range  内核内拷贝，不经过用户态；NFS、SMB 上可以由服务器端完成
+//   sendfile         内核内拷贝，copy_file_range 不可用时（较老的内核、跨文件系统）使用
+//   buffered         用户态读写，其他方式都不可用时（以及非 Linux 平台）使用
+// 每对（源设备、目标设备）第一次拷贝时探测，不支持的方式记下后不再尝试。
+// 摘要总是按目标文件中实际写入的内容计算：内核拷贝的部分随后从目标文件读回（通常在页缓存中），
+// 源文件在拷贝期间被修改时记录的摘要仍与备份文件一致
+class CopyEngine
+{
+   public:
+    enum class Method
+    {
+        Clone,
+        CopyRange,
+        Sendfile,
+        Buffered
+    };
+    static const char* name(Method method) noexcept;
+
+    // 进程内共享的实例，最快的方式由 timemachine.conf 中的 copy.engine 限定（默认 auto）
+    static CopyEngine& instance();
+
+    explicit CopyEngine(Method fastest = Method::Clone) : m_fastest(fastest) {}
+
+    // 拷贝 source 到 dest（覆盖），内容同时送入 digest 和 sample（可为空），返回摘要；
+    // 失败时抛出异常。可在多个线程中同时调用
+    std::string copy(const std::string& source, const std::string& dest, Digest& digest,
+                     Digest* sample = nullptr);
+
+    // 各方式完成的文件数，例如 "clone:0 copy_file_range:12 sendfile:0 buffered:3"
+    std::string summary() const;
+
+   private:
+    Method methodFor(uint64_t sourceDevice, uint64_t targetDevice);
+    // 记录该设备对不支持 failed，返回下一个可尝试的方式
+    Method demote(uint64_t sourceDevice, uint64_t targetDevice, Method failed);
+
+    Method m_fastest;
+    std::mutex m_mutex;
+    std::map<std::pair<uint64_t, uint64_t>, Method> m_methods;
+    std::array<std::atomic<uint64_t>, 4> m_files{};
+};
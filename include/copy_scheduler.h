@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 并行拷贝调度：每个备份目标一个队列，各队列同时运行的任务不超过 perQueue 个，
+// 全部队列共用 workers 个线程，轮流从各队列取任务，多块目标盘同时工作。
+// 任务分两部分：work 在工作线程中执行（拷贝、计算摘要），done 在调用 drain 的线程中执行
+// （写目录），数据库始终只在一个线程中访问
+class CopyScheduler
+{
+   public:
+    using Task = std::function<void()>;
+
+    // 排队（尚未开始）的任务达到 maxQueued 个时 submit 等待
+    CopyScheduler(unsigned workers, unsigned perQueue, std::size_t maxQueued);
+    // 等待已开始及排队的任务执行完，未取走的 done 不再执行
+    ~CopyScheduler();
+
+    CopyScheduler(const CopyScheduler&) = delete;
+    CopyScheduler& operator=(const CopyScheduler&) = delete;
+
+    void submit(int queue, uint64_t bytes, Task work, Task done);
+    // 执行已完成任务的 done；wait 为 true 时一直等到全部任务完成。done 抛出的异常原样传出
+    void drain(bool wait);
+    // 该队列中尚未完成的任务的字节数，用于选择目标
+    uint64_t pendingBytes(int queue) const;
+
+   private:
+    struct Item
+    {
+        uint64_t bytes;
+        Task work;
+        Task done;
+    };
+    struct Queue
+    {
+        std::deque<Item> items;
+        unsigned running = 0;
+        uint64_t pendingBytes = 0;
+    };
+
+    // 从上次取过的队列之后开始找一个未达并发上限的队列；没有时返回 m_queues.end()
+    std::map<int, Queue>::iterator nextRunnable();
+    void worker();
+
+    unsigned m_perQueue;
+    std::size_t m_maxQueued;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_workCv;  // 有新任务、有队列让出并发名额或停止
+    std::condition_variable m_doneCv;  // 有任务开始或完成
+    std::map<int, Queue> m_queues;
+    int m_lastQueue = 0;
+    std::size_t m_queued = 0;      // 尚未开始的任务
+    std::size_t m_unfinished = 0;  // 尚未完成的任务（含排队中）
+    std::deque<Task> m_done;
+    bool m_stop = false;
+    std::vector<std::thread> m_workers;
+};
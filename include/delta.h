@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Digest;
+
+// rsync 式差量编码。旧版本按固定大小分块，每块记录弱校验（rsync 滚动校验和）和强校验
+// （murmur3-128）作为签名；新内容按字节滑动窗口，弱校验命中后再比较强校验，
+// 相同的块记为“从旧版本拷贝”，其余为字面数据。编码只需要旧版本的签名，不需要读取旧版本本身；
+// 应用补丁时需要能随机读取完整的旧版本
+namespace Delta
+{
+using Sink = std::function<void(const void* data, std::size_t size)>;
+
+struct Signature
+{
+    uint32_t blockSize = 0;
+    uint64_t fileSize = 0;
+    std::vector<uint32_t> weak;
+    std::vector<std::array<uint64_t, 2>> strong;
+
+    std::vector<unsigned char> serialize() const;
+    // 数据不完整或格式不符时返回 false
+    static bool parse(const void* data, std::size_t size, Signature& out);
+};
+
+// 按顺序接收内容并生成签名（可与拷贝、差量编码同时进行）
+class SignatureBuilder
+{
+   public:
+    explicit SignatureBuilder(uint32_t blockSize);
+    ~SignatureBuilder();
+
+    void update(const void* data, std::size_t size);
+    // 返回签名后可直接开始下一次计算
+    Signature finish();
+
+   private:
+    void addBlock(const unsigned char* data, std::size_t size);
+
+    uint32_t m_blockSize;
+    std::vector<unsigned char> m_pending;
+    std::unique_ptr<Digest> m_strong;
+    Signature m_signature;
+};
+
+// 差量编码：按顺序接收新内容，补丁数据交给 sink。
+// 内存占用约为块大小加上尚未输出的字面数据（超过 1MB 即输出）
+class Encoder
+{
+   public:
+    Encoder(const Signature& basis, Sink sink);
+    ~Encoder();
+
+    void update(const void* data, std::size_t size);
+    void finish();
+
+    uint64_t literalBytes() const noexcept { return m_literalBytes; }
+    uint64_t copiedBytes() const noexcept { return m_copiedBytes; }
+    uint64_t patchBytes() const noexcept { return m_patchBytes; }
+
+   private:
+    void process(bool final);
+    bool findMatch(uint32_t& block);
+    void emitLiteral(std::size_t end);
+    void emitCopy(uint64_t offset, uint64_t size);
+    void flushCopy();
+    void write(const void* data, std::size_t size);
+
+    const Signature& m_basis;
+    Sink m_sink;
+    std::unique_ptr<Digest> m_strong;
+    uint32_t m_blockSize;
+    // 弱校验 -> 块序号；最后一个不满块大小的块不参与匹配
+    std::unordered_map<uint32_t, std::vector<uint32_t>> m_blocks;
+    std::vector<bool> m_filter;  // 弱校验的快速过滤，绝大多数位置不必查表
+
+    std::vector<unsigned char> m_buffer;
+    std::size_t m_window = 0;   // 当前窗口在 m_buffer 中的起点
+    std::size_t m_literal = 0;  // 尚未输出的字面数据起点
+    bool m_weakValid = false;
+    uint32_t m_a = 0;
+    uint32_t m_b = 0;
+    uint32_t m_nextBlock = 0;  // 上一次匹配的下一块，优先尝试，相邻的拷贝合并为一条
+    uint64_t m_copyOffset = 0;
+    uint64_t m_copySize = 0;
+    uint64_t m_outputSize = 0;
+    uint64_t m_literalBytes = 0;
+    uint64_t m_copiedBytes = 0;
+    uint64_t m_patchBytes = 0;
+};
+
+// 用 basisPath（完整的旧版本）和补丁还原新内容，按顺序交给 sink，返回还原的字节数；
+// 补丁格式错误或与旧版本不符时抛出异常
+uint64_t apply(std::istream& patch, const std::string& basisPath, const Sink& sink);
+}  // namespace Delta
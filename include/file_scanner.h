@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "models.h"
+
+// 多线程目录扫描器：每个工作线程持有一个双端队列，自己从队尾取目录，
+// 空闲时从其他线程的队首窃取。调用线程按先序遍历把结果依次交给回调，
+// 输出路径按字节序严格递增（与 SQLite 的 order by filepath 一致），便于与数据库归并。
+// 列目录时顺带取得大小、修改时间、inode 等信息（Linux 下为 readdir + statx），
+// 后续比较和拷贝直接使用这些记录。
+// 已列出但尚未交给回调的条目数超过 bufferLimit 时工作线程暂停，内存占用与目录树大小无关
+// （单个目录的条目仍会一次性读入）。
+class FileScanner
+{
+   public:
+    // 返回 false 时停止扫描
+    using Sink = std::function<bool(timemachine::FileRecord& file)>;
+
+    // threadCount 为 0 时使用 std::thread::hardware_concurrency()
+    explicit FileScanner(unsigned threadCount = 0, std::size_t bufferLimit = 65536);
+
+    // 扫描 rootPath 下的全部普通文件（跳过隐藏文件和隐藏目录），逐个交给 sink；
+    // 返回 false 表示被 sink 中止
+    bool scan(const std::string& rootPath, const Sink& sink);
+
+    // 扫描 rootPath 下的全部普通文件，追加到 fileList
+    void scan(const std::string& rootPath, std::vector<timemachine::FileRecord>& fileList);
+
+    unsigned threadCount() const noexcept { return m_threadCount; }
+
+    // 目前已列出的文件数；scanComplete() 为 true 后即为总数
+    std::size_t listedCount() const noexcept { return m_listed; }
+    bool scanComplete() const noexcept { return m_pending == 0; }
+
+    // 按扫描时的方式重新取单个文件的信息（含 ctime）；文件不存在、不是普通文件
+    // 或当前平台不支持时返回 false
+    static bool statFile(const std::string& path, timemachine::FileRecord& record);
+
+    // 路径中任一部分以 . 开头即视为隐藏
+    static bool isHiddenPath(const std::string& path);
+
+   private:
+    enum class NodeState
+    {
+        Queued,
+        Listing,
+        Done
+    };
+    struct DirNode;
+    struct Entry
+    {
+        timemachine::FileRecord file;
+        std::shared_ptr<DirNode> dir;  // 非空表示子目录
+    };
+    struct DirNode
+    {
+        std::string path;
+        std::atomic<NodeState> state{NodeState::Queued};
+        std::vector<Entry> entries;
+    };
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<std::shared_ptr<DirNode>> tasks;
+    };
+
+    void worker(std::size_t index);
+    std::shared_ptr<DirNode> takeTask(std::size_t index);
+    void pushTask(std::size_t index, std::shared_ptr<DirNode> node);
+    static bool claim(DirNode& node);
+    void processNode(std::size_t index, DirNode& node);
+    void listDirectory(std::size_t index, DirNode& node);
+    static void sortEntries(DirNode& node);
+    bool waitListed(DirNode& node);
+    void stopWorkers(std::vector<std::thread>& threads);
+
+    unsigned m_threadCount;
+    std::size_t m_bufferLimit;
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::atomic<std::size_t> m_pending{0};
+    std::atomic<std::size_t> m_listed{0};
+    std::atomic<std::size_t> m_buffered{0};
+    std::atomic<bool> m_stop{false};
+    std::mutex m_idleMutex;
+    std::condition_variable m_idleCv;
+    std::mutex m_doneMutex;
+    std::condition_variable m_doneCv;
+    std::mutex m_spaceMutex;
+    std::condition_variable m_spaceCv;
+    std::mutex m_errorMutex;
+    std::exception_ptr m_error;
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 把 size 字节编码为小写十六进制写入 out（需 2 * size 字节），不分配内存
+void hexEncode(const unsigned char* data, std::size_t size, char* out);
+
+// 增量摘要计算。算法名称保存在 tb_backfilehistory.hashalgo 中，已有的名称不可更改：
+//   md5          旧版本唯一使用的算法，默认值
+//   sha256       有 SHA-NI / ARMv8 加速指令时比 MD5 快一倍以上
+//   blake2b      64 位平台上不依赖专用指令的密码学摘要
+//   murmur3-128  MurmurHash3 x64_128，非密码学摘要，速度最快，但可以被人为构造碰撞
+//   tree-<N>m-<算法>  分块树形摘要（见 TreeDigest），例如 tree-8m-md5
+class Digest
+{
+   public:
+    virtual ~Digest() = default;
+
+    virtual void update(const void* data, std::size_t size) = 0;
+    // 结束本次计算并返回十六进制摘要，之后可直接开始下一次计算
+    virtual std::string hexFinal() = 0;
+
+    // 算法不支持时抛出 std::invalid_argument
+    static std::unique_ptr<Digest> create(const std::string& algorithm);
+    static bool isSupported(const std::string& algorithm);
+    // 基本算法（不含 tree- 形式）
+    static const std::vector<std::string>& algorithms();
+};
+
+// 分块树形摘要：内容按 chunkSize 切块，各块交给后台线程并行计算，
+// 根摘要为各块十六进制摘要按顺序拼接后再用同一算法计算的结果；空内容视为一个空块。
+// 调用方仍按顺序送入数据，同时在计算中的块不超过线程数，内存占用约为 (线程数 + 1) * chunkSize
+class TreeDigest : public Digest
+{
+   public:
+    // threads 为 0 时从 timemachine.conf 读取 hash.threads（默认 CPU 核数，最多 8）
+    TreeDigest(const std::string& leaf, std::size_t chunkSize, unsigned threads = 0);
+    ~TreeDigest() override;
+
+    TreeDigest(const TreeDigest&) = delete;
+    TreeDigest& operator=(const TreeDigest&) = delete;
+
+    void update(const void* data, std::size_t size) override;
+    std::string hexFinal() override;
+
+    // 最近一次 hexFinal 对应的各块摘要
+    const std::vector<std::string>& chunkDigests() const noexcept { return m_lastChunks; }
+    std::size_t chunkSize() const noexcept { return m_chunkSize; }
+
+    // 算法名称 tree-<chunkSize / 1MB>m-<leaf>；parse 在名称不是合法的树形摘要时返回 false
+    static std::string name(const std::string& leaf, std::size_t chunkSize);
+    static bool parse(const std::string& algorithm, std::string& leaf, std::size_t& chunkSize);
+
+   private:
+    struct Job
+    {
+        std::size_t index;
+        std::vector<unsigned char> data;
+    };
+
+    void submit();
+    void worker();
+
+    std::string m_leaf;
+    std::size_t m_chunkSize;
+    unsigned m_threadCount;
+    std::vector<unsigned char> m_current;
+    std::vector<std::string> m_chunks;
+    std::vector<std::string> m_lastChunks;
+
+    std::mutex m_mutex;
+    std::condition_variable m_jobCv;
+    std::condition_variable m_doneCv;
+    std::deque<Job> m_jobs;
+    std::vector<std::vector<unsigned char>> m_freeBuffers;
+    std::size_t m_outstanding = 0;  // 已提交但尚未算完的块
+    bool m_stop = false;
+    std::vector<std::thread> m_workers;
+};
+
+// 抽样摘要：取文件开头、中间、末尾各 sampleSize 字节（中间一段从 (fileSize - sampleSize) / 2 开始）
+// 计算 murmur3-128。内容相同则抽样摘要必然相同，所以抽样不一致即可断定文件已改变；
+// 一致时仍需完整比较。文件小于 3 * sampleSize 时三段会重叠，不做抽样。
+// 作为 Digest 使用时按顺序接收整个文件的内容，只取三段参与计算，可与拷贝同时进行
+class SampleDigest : public Digest
+{
+   public:
+    struct Range
+    {
+        uint64_t offset;
+        std::size_t size;
+    };
+    // 不适合抽样时返回 false
+    static bool ranges(uint64_t fileSize, std::size_t sampleSize, std::array<Range, 3>& out);
+
+    SampleDigest(uint64_t fileSize, std::size_t sampleSize);
+
+    void update(const void* data, std::size_t size) override;
+    // 跳过不在抽样范围内的 size 字节
+    void skip(uint64_t size);
+    // 收到的总长度与 fileSize 不一致（文件在读取期间变化）或不适合抽样时返回空字符串
+    std::string hexFinal() override;
+
+   private:
+    uint64_t m_fileSize;
+    bool m_enabled = false;
+    std::array<Range, 3> m_ranges{};
+    uint64_t m_offset = 0;
+    std::unique_ptr<Digest> m_digest;
+};
+
+// 文件摘要：每个实例持有一块按页对齐的大缓冲区，逐个文件复用，计算过程中不再分配内存。
+// 打开 useMmap 时（仅 POSIX）把文件映射进内存并提示内核顺序读取，映射失败时退回普通读取。
+// 映射期间文件被其他进程截断会触发 SIGBUS，所以默认关闭，只建议用于校验备份目录
+class FileHasher
+{
+   public:
+    struct Options
+    {
+        std::size_t bufferSize = 1 << 20;
+        bool useMmap = false;
+    };
+
+    // 从 timemachine.conf 读取 hash.buffer_kb、hash.mmap
+    static Options configuredOptions();
+    // 当前线程共享的实例（按配置创建）
+    static FileHasher& threadLocal();
+
+    explicit FileHasher(const Options& options = configuredOptions());
+
+    // 返回文件内容的摘要；文件无法打开或读取出错时返回空字符串，算法不支持时抛出异常
+    std::string hash(const std::string& filePath, const std::string& algorithm);
+    // 同上，使用调用方提供的 digest（例如需要取回 TreeDigest 的各块摘要时）
+    std::string hash(const std::string& filePath, Digest& digest);
+    std::string md5(const std::string& filePath) { return hash(filePath, "md5"); }
+    // 只读取抽样的三段计算 SampleDigest；不适合抽样或读取出错时返回空字符串
+    std::string sample(const std::string& filePath, uint64_t fileSize, std::size_t sampleSize);
+
+    const Options& options() const noexcept { return m_options; }
+
+   private:
+    struct AlignedFree
+    {
+        void operator()(unsigned char* p) const noexcept;
+    };
+
+    Digest& digest(const std::string& algorithm);
+    bool hashRead(const std::string& filePath, Digest& digest);
+    bool hashMapped(const std::string& filePath, Digest& digest, bool& mapped);
+
+    Options m_options;
+    std::unique_ptr<unsigned char, AlignedFree> m_buffer;
+    std::map<std::string, std::unique_ptr<Digest>> m_digests;
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+// 多路 MD5 的压缩函数，只供 md5_multi*.cpp 使用。
+// 每个指令集的内核在各自的源文件中用不同的编译选项实例化，模板放在匿名命名空间中，
+// 避免链接器把带 AVX 指令的实例合并给不支持的 CPU 使用
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace Md5Multi
+{
+// state 为 4 x lanes 的数组（A、B、C、D 各占连续的 lanes 个），data[i] 为第 i 路的输入，
+// 每路处理 blocks 个 64 字节块
+using KernelFn = void (*)(uint32_t* state, const unsigned char* const* data, std::size_t blocks);
+
+void blocksAvx512(uint32_t* state, const unsigned char* const* data, std::size_t blocks);
+void blocksAvx2(uint32_t* state, const unsigned char* const* data, std::size_t blocks);
+}  // namespace Md5Multi
+
+namespace
+{
+// Ops 提供 lanes、向量类型 V 以及 load/store/set1/add/和位运算，rotl<S> 为循环左移
+template <typename Ops>
+void md5Blocks(uint32_t* state, const unsigned char* const* data, std::size_t blocks)
+{
+    using V = typename Ops::V;
+    constexpr unsigned L = Ops::lanes;
+
+    V a = Ops::load(state);
+    V b = Ops::load(state + L);
+    V c = Ops::load(state + 2 * L);
+    V d = Ops::load(state + 3 * L);
+
+    alignas(64) uint32_t words[16][L];
+    for (std::size_t block = 0; block < blocks; ++block)
+    {
+        // 转置：words[j] 为各路第 j 个 32 位字（MD5 按小端读取）
+        for (unsigned lane = 0; lane < L; ++lane)
+        {
+            const unsigned char* p = data[lane] + block * 64;
+            for (unsigned j = 0; j < 16; ++j)
+            {
+                words[j][lane] = static_cast<uint32_t>(p[4 * j]) |
+                                 static_cast<uint32_t>(p[4 * j + 1]) << 8 |
+                                 static_cast<uint32_t>(p[4 * j + 2]) << 16 |
+                                 static_cast<uint32_t>(p[4 * j + 3]) << 24;
+            }
+        }
+        V x[16];
+        for (unsigned j = 0; j < 16; ++j)
+        {
+            x[j] = Ops::load(words[j]);
+        }
+
+        const V aa = a;
+        const V bb = b;
+        const V cc = c;
+        const V dd = d;
+
+#define MD5_F(b, c, d) Ops::bitXor(d, Ops::bitAnd(b, Ops::bitXor(c, d)))
+#define MD5_G(b, c, d) Ops::bitXor(c, Ops::bitAnd(d, Ops::bitXor(b, c)))
+#define MD5_H(b, c, d) Ops::bitXor(b, Ops::bitXor(c, d))
+#define MD5_I(b, c, d) Ops::bitXor(c, Ops::bitOr(b, Ops::bitNot(d)))
+#define MD5_STEP(f, a, b, c, d, k, t, s)                                                     \
+    a = Ops::add(a, Ops::add(f(b, c, d), Ops::add(x[k], Ops::set1(static_cast<uint32_t>(t))))); \
+    a = Ops::add(Ops::template rotl<s>(a), b);
+
+        MD5_STEP(MD5_F, a, b, c, d, 0, 0xd76aa478, 7)
+        MD5_STEP(MD5_F, d, a, b, c, 1, 0xe8c7b756, 12)
+        MD5_STEP(MD5_F, c, d, a, b, 2, 0x242070db, 17)
+        MD5_STEP(MD5_F, b, c, d, a, 3, 0xc1bdceee, 22)
+        MD5_STEP(MD5_F, a, b, c, d, 4, 0xf57c0faf, 7)
+        MD5_STEP(MD5_F, d, a, b, c, 5, 0x4787c62a, 12)
+        MD5_STEP(MD5_F, c, d, a, b, 6, 0xa8304613, 17)
+        MD5_STEP(MD5_F, b, c, d, a, 7, 0xfd469501, 22)
+        MD5_STEP(MD5_F, a, b, c, d, 8, 0x698098d8, 7)
+        MD5_STEP(MD5_F, d, a, b, c, 9, 0x8b44f7af, 12)
+        MD5_STEP(MD5_F, c, d, a, b, 10, 0xffff5bb1, 17)
+        MD5_STEP(MD5_F, b, c, d, a, 11, 0x895cd7be, 22)
+        MD5_STEP(MD5_F, a, b, c, d, 12, 0x6b901122, 7)
+        MD5_STEP(MD5_F, d, a, b, c, 13, 0xfd987193, 12)
+        MD5_STEP(MD5_F, c, d, a, b, 14, 0xa679438e, 17)
+        MD5_STEP(MD5_F, b, c, d, a, 15, 0x49b40821, 22)
+
+        MD5_STEP(MD5_G, a, b, c, d, 1, 0xf61e2562, 5)
+        MD5_STEP(MD5_G, d, a, b, c, 6, 0xc040b340, 9)
+        MD5_STEP(MD5_G, c, d, a, b, 11, 0x265e5a51, 14)
+        MD5_STEP(MD5_G, b, c, d, a, 0, 0xe9b6c7aa, 20)
+        MD5_STEP(MD5_G, a, b, c, d, 5, 0xd62f105d, 5)
+        MD5_STEP(MD5_G, d, a, b, c, 10, 0x02441453, 9)
+        MD5_STEP(MD5_G, c, d, a, b, 15, 0xd8a1e681, 14)
+        MD5_STEP(MD5_G, b, c, d, a, 4, 0xe7d3fbc8, 20)
+        MD5_STEP(MD5_G, a, b, c, d, 9, 0x21e1cde6, 5)
+        MD5_STEP(MD5_G, d, a, b, c, 14, 0xc33707d6, 9)
+        MD5_STEP(MD5_G, c, d, a, b, 3, 0xf4d50d87, 14)
+        MD5_STEP(MD5_G, b, c, d, a, 8, 0x455a14ed, 20)
+        MD5_STEP(MD5_G, a, b, c, d, 13, 0xa9e3e905, 5)
+        MD5_STEP(MD5_G, d, a, b, c, 2, 0xfcefa3f8, 9)
+        MD5_STEP(MD5_G, c, d, a, b, 7, 0x676f02d9, 14)
+        MD5_STEP(MD5_G, b, c, d, a, 12, 0x8d2a4c8a, 20)
+
+        MD5_STEP(MD5_H, a, b, c, d, 5, 0xfffa3942, 4)
+        MD5_STEP(MD5_H, d, a, b, c, 8, 0x8771f681, 11)
+        MD5_STEP(MD5_H, c, d, a, b, 11, 0x6d9d6122, 16)
+        MD5_STEP(MD5_H, b, c, d, a, 14, 0xfde5380c, 23)
+        MD5_STEP(MD5_H, a, b, c, d, 1, 0xa4beea44, 4)
+        MD5_STEP(MD5_H, d, a, b, c, 4, 0x4bdecfa9, 11)
+        MD5_STEP(MD5_H, c, d, a, b, 7, 0xf6bb4b60, 16)
+        MD5_STEP(MD5_H, b, c, d, a, 10, 0xbebfbc70, 23)
+        MD5_STEP(MD5_H, a, b, c, d, 13, 0x289b7ec6, 4)
+        MD5_STEP(MD5_H, d, a, b, c, 0, 0xeaa127fa, 11)
+        MD5_STEP(MD5_H, c, d, a, b, 3, 0xd4ef3085, 16)
+        MD5_STEP(MD5_H, b, c, d, a, 6, 0x04881d05, 23)
+        MD5_STEP(MD5_H, a, b, c, d, 9, 0xd9d4d039, 4)
+        MD5_STEP(MD5_H, d, a, b, c, 12, 0xe6db99e5, 11)
+        MD5_STEP(MD5_H, c, d, a, b, 15, 0x1fa27cf8, 16)
+        MD5_STEP(MD5_H, b, c, d, a, 2, 0xc4ac5665, 23)
+
+        MD5_STEP(MD5_I, a, b, c, d, 0, 0xf4292244, 6)
+        MD5_STEP(MD5_I, d, a, b, c, 7, 0x432aff97, 10)
+        MD5_STEP(MD5_I, c, d, a, b, 14, 0xab9423a7, 15)
+        MD5_STEP(MD5_I, b, c, d, a, 5, 0xfc93a039, 21)
+        MD5_STEP(MD5_I, a, b, c, d, 12, 0x655b59c3, 6)
+        MD5_STEP(MD5_I, d, a, b, c, 3, 0x8f0ccc92, 10)
+        MD5_STEP(MD5_I, c, d, a, b, 10, 0xffeff47d, 15)
+        MD5_STEP(MD5_I, b, c, d, a, 1, 0x85845dd1, 21)
+        MD5_STEP(MD5_I, a, b, c, d, 8, 0x6fa87e4f, 6)
+        MD5_STEP(MD5_I, d, a, b, c, 15, 0xfe2ce6e0, 10)
+        MD5_STEP(MD5_I, c, d, a, b, 6, 0xa3014314, 15)
+        MD5_STEP(MD5_I, b, c, d, a, 13, 0x4e0811a1, 21)
+        MD5_STEP(MD5_I, a, b, c, d, 4, 0xf7537e82, 6)
+        MD5_STEP(MD5_I, d, a, b, c, 11, 0xbd3af235, 10)
+        MD5_STEP(MD5_I, c, d, a, b, 2, 0x2ad7d2bb, 15)
+        MD5_STEP(MD5_I, b, c, d, a, 9, 0xeb86d391, 21)
+
+#undef MD5_STEP
+#undef MD5_I
+#undef MD5_H
+#undef MD5_G
+#undef MD5_F
+
+        a = Ops::add(a, aa);
+        b = Ops::add(b, bb);
+        c = Ops::add(c, cc);
+        d = Ops::add(d, dd);
+    }
+
+    Ops::store(state, a);
+    Ops::store(state + L, b);
+    Ops::store(state + 2 * L, c);
+    Ops::store(state + 3 * L, d);
+}
+}  // namespace
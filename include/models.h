@@ -16,7 +16,41 @@ struct BackupHistory
     std::string backuptargetpath;
     std::string backuptargetfullpath;
     int backuptargetrootid = 0;
-    std::string md5;
+    std::string md5;  // 摘要值，算法见 hashalgo
+    std::string hashalgo = "md5";
+    std::string sampledigest;
+    int64_t samplekb = 0;
+    std::string copystarttime;
+    std::string copyendtime;
+    std::string storage = "file";  // file：整个文件一个对象；chunks：按块保存，见 tb_manifestchunks；
+                                   // append：只保存相对 basehistoryid 追加的部分
+    int64_t basehistoryid = 0;
+    int64_t chaindepth = 0;  // 恢复时需要依次拼接的追加版本数
+};
+
+// 扫描阶段得到的源文件信息，比较和拷贝阶段不再重复 stat
+struct FileRecord
+{
+    std::string path;
+    int64_t filesize = 0;
+    int64_t motifytime = 0;  // 毫秒时间戳，与 Utils::getSysFileMilliTimeStamp 一致
+    uint64_t inode = 0;
+    uint64_t device = 0;
+    int64_t changetime = 0;  // ctime（纳秒），0 表示未取得（非 Linux 平台）
+};
+
+// tb_backfiles 中的一个文件及其最新一次备份（historyid 为 0 表示还没有版本）
+struct BackupFile
+{
+    int64_t id = 0;
+    std::string filepath;
+    int64_t historyid = 0;
+    int64_t motifytime = 0;
+    int64_t filesize = 0;
+    std::string md5;  // 摘要值，算法见 hashalgo
+    std::string hashalgo = "md5";
+    std::string sampledigest;  // 抽样摘要（见 SampleDigest），空表示没有
+    int64_t samplekb = 0;
 };
 
 struct Backuproot
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "sqlite_helper.h"
+
+// 数据库结构版本管理：版本号保存在 PRAGMA user_version，
+// ServiceRun::init 时按顺序执行尚未应用的迁移，已有的数据库原地升级
+class SchemaMigration
+{
+   public:
+    explicit SchemaMigration(SQLiteHelper& helper) : m_sqliteHelper(helper) {}
+
+    // 执行全部未应用的迁移，每个迁移与版本号更新在同一个事务中完成
+    void migrate();
+
+    int currentVersion();
+    static int latestVersion();
+
+    // 检查热点查询的执行计划，返回出现全表扫描的查询及其计划
+    std::vector<std::string> checkQueryPlans();
+
+   private:
+    SQLiteHelper& m_sqliteHelper;
+};
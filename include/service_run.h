@@ -1,8 +1,13 @@
 #pragma once
 
 #include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
 #include <vector>
 
+#include "copy_scheduler.h"
 #include "models.h"
 #include "sqlite_helper.h"
 #include "util.h"
@@ -10,13 +15,27 @@
 class ServiceRun
 {
    public:
+    // ͬʹòͬݿܲ timemachine.conf е db.* 
+    enum class Workload
+    {
+        Backup,   // ݡԴ
+        Scrub,    // checkdata У
+        Restore   // ָ list/add/rm ȶ
+    };
+
     ServiceRun() : m_sqliteHelper("timemachine.db") {}
-    void init();
+    // ݿ⣬Ӧ workload ӦִܲδӦõĽṹǨ
+    void init(Workload workload = Workload::Backup);
+    // ȵѯǷȫɨʱ¼󲢷 false
+    bool checkQueryPlans();
     void loadBackupRoot();
     void deleteByBackuprootid(int64_t rootid);
     void XCopy();
     // 鱸Ƿ𻵲Ƴ𻵱
     void checkdata(bool withhash);
+    // ѸĿĿ¼ƽ̵ıļǨƵֲ㲼֣store.layoutҪ±ݣ
+    // ޸Ŀ¼ʱжϺִУǨڼָУճ
+    bool reshardTargets();
     void listBackupPaths();
     bool addSourcePath(const std::string& source);
     bool addTargetPath(const std::string& target);
@@ -25,12 +44,123 @@ class ServiceRun
     bool restoreFile(const std::string& filePath);
 
    private:
-    static void loadAllFiles(const std::string& pathName,
-                             std::vector<std::string>& fileList);
     std::optional<timemachine::Backuptargetroot> getAvailableTarget(uintmax_t needspace);
-    static void copyFile(const std::string& source, const std::string& dest);
-    bool exeCopy(const std::string& fileName, int64_t backupfileid);
+    //  CopyEngine ļûںڿʱû̬رļݵժҪ
+    // ĿĿ¼ʱԶ
+    static std::string copyFile(const std::string& source, const std::string& dest,
+                                Digest& digest, Digest* sample = nullptr);
+    bool exeCopy(const timemachine::FileRecord& file, int64_t backupfileid);
+    // exeCopy ȷϲȥ֮ı棺ֿͨ
+    bool storeNewFile(const timemachine::FileRecord& file, timemachine::BackupHistory& history,
+                      Digest& digest);
+    // ͨһļrunCopyJob ʱļڹִ߳У
+    // finishCopyJob дͰ汾¼ֻڷݿִ߳У
+    struct CopyJob
+    {
+        timemachine::FileRecord file;
+        timemachine::BackupHistory history;
+        timemachine::Backuptargetroot target;
+        std::string timestamp;
+        std::unique_ptr<Digest> digest;
+        std::string targetFull;
+        std::string error;
+        bool uring = false;  //  io_uring ο
+        uint64_t seq = 0;    // пύţͬΪ 0
+    };
+    static void runCopyJob(CopyJob& job);
+    // ʱļɺΪƣʧʱɾʱļ¼ job.error
+    static void commitCopyJob(CopyJob& job, const std::string& tempFull);
+    bool finishCopyJob(CopyJob& job);
+    // Сļܳһ io_uring һ߳пcopy.uringʱ
+    using CopyBatch = std::vector<std::shared_ptr<CopyJob>>;
+    static void runCopyBatch(CopyBatch& jobs);
+    void submitCopyBatch(int targetId);
+    // пɺڱִ߳УдĿ¼ȴÿȥصļ
+    void copyDone(CopyJob& job);
+    // пСδд tb_objects ļҲȥأС㷨֮ͬļȼժҪ
+    // Щɺͬ䱸ļȴʱڿĶͬٿ
+    struct DedupWaiter
+    {
+        timemachine::FileRecord file;
+        timemachine::BackupHistory history;
+        std::shared_ptr<Digest> digest;  // Digest ڴ˲vector Ҫ shared_ptr
+        uint64_t lastSeq = 0;  // ʼȴʱύĿ
+    };
+    using SizeKey = std::pair<int64_t, std::string>;
+    void settleDedupWaiters(const CopyJob& job);
+    // ĿŶӻδдֽ
+    uint64_t pendingCopyBytes(int targetId) const;
+    // ִɿĿ¼д룬wait Ϊ true ʱȫɣпʧʱ false
+    bool drainCopies(bool wait);
+    // ϸĺʱĿϵʱļͱļɴɣ
+    // ߳뱾߳ͬʱдͬһĿ¼ʱҲ
+    std::string uniqueTimestamp();
     void XCopy(const timemachine::Backuproot& backuproot);
+    bool reshardTarget(const timemachine::Backuptargetroot& target);
+    bool backupFile(const timemachine::Backuproot& backuproot,
+                    const timemachine::FileRecord& record,
+                    const timemachine::BackupFile* known);
+    // Сͬ޸ʱ䲻ͬļҪ¼ժҪȷǷ仯
+    // MD5 ıȽܳһö· MD5 һ
+    struct PendingCompare
+    {
+        timemachine::FileRecord record;
+        timemachine::BackupFile known;
+    };
+    bool compareDigest(const PendingCompare& pending, const std::string& digest);
+    bool flushPendingCompares();
+    // ԴļժҪ棬 tb_hashcacheδʱؿַ
+    std::string cachedDigest(const timemachine::FileRecord& record, const std::string& algorithm);
+    void cacheDigest(const timemachine::FileRecord& record, const std::string& algorithm,
+                     const std::string& digest);
+    bool copyVersion(const timemachine::FileRecord& record, int64_t backupfileid);
+    // Ѱַ洢ͬİ汾ͬһļtb_objects ¼
+    // һͷʱɾļ
+    struct StoredObject
+    {
+        int64_t id = 0;
+        int backuptargetrootid = 0;
+        std::string backuptargetpath;
+    };
+    std::optional<StoredObject> findObject(int64_t filesize, const std::string& algorithm,
+                                           const std::string& digest);
+    // ж󱣴°汾
+    void referenceObject(const timemachine::FileRecord& file, timemachine::BackupHistory& history,
+                         const Digest& digest, const StoredObject& object);
+    void releaseObject(int targetrootid, const std::string& targetpath,
+                       const std::string& fullpath);
+    // д汾¼ժҪĸժҪļ°汾ذ汾 id
+    int64_t insertVersion(const timemachine::BackupHistory& history, const Digest& digest);
+    // ļݷֿ鱣棨store.chunk_min_mbΪĿ chunks Ŀ¼£
+    // 汾ļã汾ֻ¼嵥
+    bool storeChunked(const timemachine::FileRecord& file,
+                      const timemachine::Backuptargetroot& target,
+                      timemachine::BackupHistory& history, Digest& digest);
+    // ֻļ־ȣȷԭȲ°汾һºֻ׷ӵĲ֣store.append
+    // ǵ׷ӻ׷Ѵʱͨʽ
+    bool storeAppend(const timemachine::FileRecord& record, const timemachine::BackupFile& known,
+                     int64_t backupfileid);
+    // ԭ޸ĵĴļݿ⡢ȣ棨store.delta_*°汾ǩ룬
+    // ֻд仯ݺͿָûпǩѴ޻򲹶Сʱ汾
+    // ͬʱ°汾ǩһαʹ
+    bool storeDelta(const timemachine::FileRecord& file,
+                    const timemachine::Backuptargetroot& target,
+                    timemachine::BackupHistory& history, Digest& digest);
+    // 嵥׷Ӽ汾ԭ汾ݵ dest˶ļժҪ滻 dest
+    bool restoreAssembled(const timemachine::BackupHistory& history,
+                          const std::filesystem::path& dest);
+    // Ѱ汾 historyid д out  digestֽʧʱ׳쳣
+    // в汾ʱм汾Ȼԭ scratchDir µʱļ
+    int64_t writeVersionContent(int64_t historyid, std::ostream& out, Digest& digest,
+                                const std::filesystem::path& scratchDir);
+    // 嵥еĸǷڡСժҪǷȷchecked ¼УѼĶ
+    bool verifyManifest(const timemachine::BackupHistory& history, bool withhash,
+                        std::map<int64_t, bool>& checked);
+    // ׷ӡ汾ıļ汾broken ΪУж𻵵İ汾
+    bool verifyDerived(const timemachine::BackupHistory& history, bool withhash,
+                       const std::set<int64_t>& broken);
+    // ɾ汾¼ͷõĶļ飩
+    void deleteVersion(const timemachine::BackupHistory& history);
     int beginbackup();
     void finishbackup();
     std::string getTargetrootPath(int targetbkid);
@@ -45,5 +175,35 @@ class ServiceRun
     int64_t m_fileCopyCount = 0;
     int64_t m_dataCopyCount = 0;
     int m_backupId = 0;
+    // ѿδȷ̵ļύǰͳһˢ
+    std::vector<std::string> m_unsyncedFiles;
+    std::vector<PendingCompare> m_pendingCompares;
+    // пcopy.parallelֻ XCopy ڼ
+    std::unique_ptr<CopyScheduler> m_copyScheduler;
+    bool m_copyFailed = false;
+    // ĿδύСļ
+    std::map<int, CopyBatch> m_copyBatches;
+    std::map<int, uint64_t> m_copyBatchBytes;
+    bool m_uringCopy = false;
+    int64_t m_uringCopyCount = 0;
+    // С㷨ڿύţԼȴǵļ
+    std::map<SizeKey, std::set<uint64_t>> m_inflightCopies;
+    std::map<SizeKey, std::vector<DedupWaiter>> m_dedupWaiters;
+    uint64_t m_copySeq = 0;
+    int64_t m_lastTimestamp = 0;
+    int64_t m_digestCacheHits = 0;
+    int64_t m_sampleRejects = 0;
+    int64_t m_dedupCount = 0;
+    int64_t m_dedupBytes = 0;
+    int64_t m_chunkedCount = 0;
+    int64_t m_chunkedBytes = 0;
+    int64_t m_chunkStoredBytes = 0;  // ֿ鱣ʱʵдֽ
+    int64_t m_appendCount = 0;
+    int64_t m_appendBytes = 0;
+    bool m_deltaRoot = false;  // ǰԴǷ񰴲ļstore.delta_roots
+    int64_t m_deltaCount = 0;
+    int64_t m_deltaBytes = 0;
+    int64_t m_deltaStoredBytes = 0;  // 汾ʵдĲֽ
     inline static constexpr std::string_view targetBkDirName = "BACKUPDATABASE";
+    inline static constexpr std::string_view chunkDirName = "chunks";
 };
\ No newline at end of file
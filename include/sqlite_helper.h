@@ -1,10 +1,51 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 #include <SQLiteCpp/SQLiteCpp.h>
 
+// 借用 SQLiteHelper 缓存中的语句；析构时 reset，语句不再占用读锁，可被下一次调用复用
+class CachedStatement
+{
+public:
+    CachedStatement() = default;
+    explicit CachedStatement(SQLite::Statement* stmt) : m_stmt(stmt) {}
+    CachedStatement(CachedStatement&& other) noexcept : m_stmt(other.m_stmt) { other.m_stmt = nullptr; }
+    CachedStatement& operator=(CachedStatement&&) = delete;
+    ~CachedStatement();
+
+    explicit operator bool() const noexcept { return m_stmt != nullptr; }
+    SQLite::Statement* operator->() const noexcept { return m_stmt; }
+    SQLite::Statement& operator*() const noexcept { return *m_stmt; }
+
+private:
+    SQLite::Statement* m_stmt = nullptr;
+};
+
+// 打开数据库后应用的性能参数；字符串取值须为单个单词（如 wal、normal、memory）
+struct SQLiteProfile
+{
+    std::string name;  // 用于日志
+    std::string journalMode = "wal";
+    std::string synchronous = "normal";
+    int64_t cacheSizeKb = 2000;
+    int64_t mmapSize = 0;  // 字节，0 表示不使用 mmap
+    std::string tempStore = "default";
+    int64_t busyTimeoutMs = 5000;
+    // 大于 0 时关闭提交时的自动 checkpoint，改由后台线程按此间隔（毫秒）执行 PASSIVE checkpoint
+    int64_t checkpointMillis = 0;
+};
+
+class WalCheckpointer;
+
 class SQLiteHelper
 {
 public:
@@ -20,10 +61,113 @@ public:
     // 返回准备好的语句（注意：Statement 持有对 Database 的引用，确保 Database 未被 close）
     std::unique_ptr<SQLite::Statement> prepareQuery(const std::string& sql);
 
+    // 从缓存取出（首次使用时编译）按 SQL 文本缓存的语句，并依次绑定 ? 参数。
+    // 热路径的查询应使用这一接口：不重复解析 SQL，参数也无需拼接和转义
+    template <typename... Args>
+    CachedStatement query(const std::string& sql, const Args&... args)
+    {
+        SQLite::Statement* stmt = cachedStatement(sql);
+        if (stmt != nullptr)
+        {
+            int index = 0;
+            (bindValue(*stmt, ++index, args), ...);
+        }
+        return CachedStatement(stmt);
+    }
+
+    // 执行带参数的写语句，返回受影响的行数（失败时抛出异常）
+    template <typename... Args>
+    int exec(const std::string& sql, const Args&... args)
+    {
+        auto stmt = query(sql, args...);
+        if (!stmt)
+        {
+            throw SQLite::Exception("SQLiteHelper: cannot prepare [" + sql + "]");
+        }
+        return stmt->exec();
+    }
+
+    int64_t lastInsertRowid() const noexcept;
+
+    // 应用性能参数（须在事务之外调用），返回实际生效的参数说明
+    std::string applyProfile(const SQLiteProfile& profile);
+
+    // 显式事务（失败时与 execSql 一样抛出异常）
+    void beginTransaction();
+    void commitTransaction();
+    void rollbackTransaction() noexcept;
+    bool inTransaction() const noexcept;
+
     // 关闭并释放数据库资源
     void close() noexcept;
 
 private:
+    SQLite::Statement* cachedStatement(const std::string& sql);
+
+    template <typename T>
+    static void bindValue(SQLite::Statement& stmt, int index, const T& value)
+    {
+        if constexpr (std::is_same_v<T, std::nullptr_t>)
+        {
+            stmt.bind(index);
+        }
+        else if constexpr (std::is_same_v<T, bool>)
+        {
+            stmt.bind(index, value ? 1 : 0);
+        }
+        else if constexpr (std::is_integral_v<T>)
+        {
+            stmt.bind(index, static_cast<int64_t>(value));
+        }
+        else if constexpr (std::is_floating_point_v<T>)
+        {
+            stmt.bind(index, static_cast<double>(value));
+        }
+        else if constexpr (std::is_same_v<T, std::string>)
+        {
+            stmt.bind(index, value);
+        }
+        else if constexpr (std::is_same_v<T, std::vector<unsigned char>>)
+        {
+            // 二进制数据按 BLOB 绑定
+            stmt.bind(index, value.data(), static_cast<int>(value.size()));
+        }
+        else
+        {
+            stmt.bind(index, std::string(std::string_view(value)));
+        }
+    }
+
     std::string m_dbname;
     std::unique_ptr<SQLite::Database> m_dataBase;
+    std::unordered_map<std::string, std::unique_ptr<SQLite::Statement>> m_statements;
+    std::unique_ptr<WalCheckpointer> m_checkpointer;
+};
+
+// 批量提交：构造时开启事务，每累计 maxRows 次 add() 或超过 maxMillis 毫秒提交一次并开启新事务，
+// 析构时提交剩余部分。提交前先调用 beforeCommit（例如把已拷贝的文件刷到磁盘），
+// 保证数据库里的记录不会先于它所指向的数据落盘。
+class TransactionBatch
+{
+public:
+    TransactionBatch(SQLiteHelper& helper, std::size_t maxRows, int64_t maxMillis,
+                     std::function<void()> beforeCommit = {});
+    ~TransactionBatch();
+
+    TransactionBatch(const TransactionBatch&) = delete;
+    TransactionBatch& operator=(const TransactionBatch&) = delete;
+
+    void add(std::size_t rows = 1);
+    // 立即提交并开启新事务
+    void flush();
+
+private:
+    void commit();
+
+    SQLiteHelper& m_helper;
+    std::size_t m_maxRows;
+    std::chrono::milliseconds m_maxDuration;
+    std::function<void()> m_beforeCommit;
+    std::size_t m_rows = 0;
+    std::chrono::steady_clock::time_point m_begin;
 };
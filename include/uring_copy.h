@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Digest;
+
+// io_uring 批量拷贝（仅 Linux，直接使用系统调用，不依赖 liburing）。
+// 一个线程同时处理 depth 个文件，每个文件依次提交 openat、read、write、fsync（可选）、close，
+// 上一步完成后立即提交下一步，一次 io_uring_enter 同时提交和收取多个文件的请求；
+// 大量小文件时系统调用次数和线程切换远少于逐个同步拷贝。摘要在调用线程中按顺序计算。
+// 内核不支持（或被禁用）时 available() 返回 false，调用方改用线程池拷贝
+class UringCopier
+{
+   public:
+    struct Item
+    {
+        std::string source;
+        std::string dest;
+        Digest* digest = nullptr;
+        Digest* sample = nullptr;  // 可为空
+        std::string hex;           // 完成后为内容的摘要
+        std::string error;         // 非空表示该文件拷贝失败，目标文件可能不完整
+    };
+
+    // 进程内只探测一次：能否创建 io_uring 且支持所需的全部操作
+    static bool available();
+
+    // 创建失败时抛出异常
+    explicit UringCopier(unsigned depth = 32, std::size_t chunkSize = 256 << 10,
+                         bool fsync = false);
+    ~UringCopier();
+
+    UringCopier(const UringCopier&) = delete;
+    UringCopier& operator=(const UringCopier&) = delete;
+
+    // 拷贝全部文件，各文件的结果写回 items；单个文件失败不影响其他文件
+    void copy(std::vector<Item>& items);
+
+   private:
+    struct Ring;
+    std::unique_ptr<Ring> m_ring;
+    unsigned m_depth;
+    std::size_t m_chunkSize;
+    bool m_fsync;
+};
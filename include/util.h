@@ -1,5 +1,4 @@
 #pragma once
-#include <openssl/md5.h>
 
 #include <chrono>
 #include <ctime>
@@ -10,6 +9,10 @@
 #include <iostream>
 #include <mutex>
 #include <sstream>
+#include <string>
+#include <vector>
+
+class Digest;
 
 namespace Utils
 {
@@ -97,6 +100,21 @@ class Log
 std::string replace(std::string str, const std::string& from, const std::string& to);
 std::string trim(const std::string& str);
 std::string getFileMD5(const std::string& filePath);
+// 按指定算法（见 hasher.h 中的 Digest）计算文件摘要，读取失败时返回空字符串
+std::string getFileDigest(const std::string& filePath, const std::string& algorithm);
+// 一次读取源文件，同时用 digest 计算摘要并写入目标文件（目标已存在时覆盖），返回摘要；
+// sample 非空时内容也送入 sample（由调用方取结果）。失败时抛出异常
+std::string copyFileWithDigest(const std::string& source, const std::string& dest,
+                               Digest& digest, Digest* sample = nullptr);
+// 只拷贝追加的部分：读取整个源文件，前 offset 字节送入 prefix，之后的字节送入 tail 并写入目标文件；
+// 全部内容送入 digest 和 sample（可为空）。返回 digest 的结果，prefix、tail 由调用方取结果；
+// 源文件不足 offset 字节或读写失败时抛出异常
+std::string copyFileTailWithDigest(const std::string& source, const std::string& dest,
+                                   uint64_t offset, Digest& prefix, Digest& tail, Digest& digest,
+                                   Digest* sample = nullptr);
+
+// 把文件内容刷到磁盘：Linux 下每个文件系统调用一次 syncfs，其他平台逐个文件刷新；失败时抛出异常
+void syncFiles(const std::vector<std::string>& files);
 
 inline int64_t getMilliTimeStamp()
 {
@@ -105,14 +123,18 @@ inline int64_t getMilliTimeStamp()
         .count();
 }
 
-inline time_t getSysFileMilliTimeStamp(const std::filesystem::path& filePath)
+inline time_t toMilliTimeStamp(std::filesystem::file_time_type fileTime)
 {
     return std::chrono::duration_cast<std::chrono::milliseconds>(
-               (std::filesystem::last_write_time(filePath) -
-                std::filesystem::file_time_type::clock::now() +
+               (fileTime - std::filesystem::file_time_type::clock::now() +
                 std::chrono::system_clock::now())
                    .time_since_epoch())
         .count();
 }
 
+inline time_t getSysFileMilliTimeStamp(const std::filesystem::path& filePath)
+{
+    return toMilliTimeStamp(std::filesystem::last_write_time(filePath));
+}
+
 }  // namespace Utils
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include "chunker.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include "config.h"
+
+namespace
+{
+// gear 表由固定种子的 splitmix64 生成；修改后已有的块不再能与新版本的块匹配
+const std::array<uint64_t, 256>& gearTable()
+{
+    static const std::array<uint64_t, 256> table = []
+    {
+        std::array<uint64_t, 256> values{};
+        uint64_t state = 0x7469'6d65'6d61'6368ull;
+        for (auto& value : values)
+        {
+            state += 0x9e37'79b9'7f4a'7c15ull;
+            uint64_t z = state;
+            z = (z ^ (z >> 30)) * 0xbf58'476d'1ce4'e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d0'49bb'1331'11ebull;
+            value = z ^ (z >> 31);
+        }
+        return values;
+    }();
+    return table;
+}
+
+// 每读入一个字节指纹左移一位，最高位受最近 64 个字节影响，所以掩码取高位
+uint64_t highBits(unsigned bits)
+{
+    return bits == 0 ? 0 : ~0ull << (64 - bits);
+}
+}  // namespace
+
+Chunker::Chunker(std::size_t avgSize)
+{
+    unsigned bits = 12;
+    while (bits < 30 && (std::size_t{1} << (bits + 1)) <= avgSize)
+    {
+        ++bits;
+    }
+    m_avgSize = std::size_t{1} << bits;
+    m_minSize = m_avgSize / 4;
+    m_maxSize = m_avgSize * 4;
+    m_maskSmall = highBits(bits + 2);
+    m_maskLarge = highBits(bits - 2);
+}
+
+Chunker Chunker::configured()
+{
+    const auto avgKb = Config::instance().getInt("store.chunk_avg_kb", 1024);
+    return Chunker(static_cast<std::size_t>(std::max<int64_t>(avgKb, 4)) * 1024);
+}
+
+std::size_t Chunker::cut(const unsigned char* data, std::size_t size) const
+{
+    if (size <= m_minSize)
+    {
+        return size;
+    }
+    const auto end = std::min(size, m_maxSize);
+    const auto normal = std::min(end, m_avgSize);
+    const auto& gear = gearTable();
+    uint64_t fingerprint = 0;
+    std::size_t i = m_minSize;
+    for (; i < normal; ++i)
+    {
+        fingerprint = (fingerprint << 1) + gear[data[i]];
+        if ((fingerprint & m_maskSmall) == 0)
+        {
+            return i + 1;
+        }
+    }
+    for (; i < end; ++i)
+    {
+        fingerprint = (fingerprint << 1) + gear[data[i]];
+        if ((fingerprint & m_maskLarge) == 0)
+        {
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+std::size_t Chunker::split(const std::string& path, const Sink& sink) const
+{
+    std::ifstream in(std::filesystem::u8path(path), std::ifstream::binary);
+    if (!in)
+    {
+        throw std::runtime_error("cannot open source file: " + path);
+    }
+    // 缓冲中始终保留至少 maxSize 字节（或文件剩余的全部内容）再寻找切分点
+    std::vector<unsigned char> buffer(m_maxSize * 2);
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    std::size_t chunks = 0;
+    bool eof = false;
+    while (true)
+    {
+        if (!eof && end - begin < m_maxSize)
+        {
+            std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+            in.read(reinterpret_cast<char*>(buffer.data() + end),
+                    static_cast<std::streamsize>(buffer.size() - end));
+            end += static_cast<std::size_t>(in.gcount());
+            if (in.bad())
+            {
+                throw std::runtime_error("failed to read source file: " + path);
+            }
+            eof = !in;
+            continue;
+        }
+        if (begin == end)
+        {
+            break;
+        }
+        const auto size = cut(buffer.data() + begin, end - begin);
+        sink(buffer.data() + begin, size);
+        begin += size;
+        ++chunks;
+    }
+    return chunks;
+}
@@ -0,0 +1,65 @@
+#include "config.h"
+
+#include <fstream>
+
+#include "util.h"
+
+Config::Config(const std::string& fileName)
+{
+    std::ifstream file(std::filesystem::u8path(fileName));
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = Utils::trim(line);
+        if (line.empty() || line.front() == '#')
+        {
+            continue;
+        }
+        const auto pos = line.find('=');
+        if (pos == std::string::npos)
+        {
+            continue;
+        }
+        m_values[Utils::trim(line.substr(0, pos))] = Utils::trim(line.substr(pos + 1));
+    }
+}
+
+const Config& Config::instance()
+{
+    static const Config config;
+    return config;
+}
+
+std::string Config::getString(const std::string& key, const std::string& def) const
+{
+    auto it = m_values.find(key);
+    return it == m_values.end() ? def : it->second;
+}
+
+int64_t Config::getInt(const std::string& key, int64_t def) const
+{
+    auto it = m_values.find(key);
+    if (it == m_values.end())
+    {
+        return def;
+    }
+    try
+    {
+        return std::stoll(it->second);
+    }
+    catch (const std::exception&)
+    {
+        return def;
+    }
+}
+
+bool Config::getBool(const std::string& key, bool def) const
+{
+    auto it = m_values.find(key);
+    if (it == m_values.end())
+    {
+        return def;
+    }
+    return it->second == "1" || it->second == "true" || it->second == "on" ||
+           it->second == "yes";
+}
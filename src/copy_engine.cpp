@@ -0,0 +1,344 @@
+#include "copy_engine.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "config.h"
+#include "hasher.h"
+#include "util.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+// 每次拷贝、读回计算摘要的块大小
+constexpr std::size_t copyBlockSize = 1 << 20;
+
+#ifdef __linux__
+class FileDescriptor
+{
+   public:
+    explicit FileDescriptor(int fd) : m_fd(fd) {}
+    ~FileDescriptor()
+    {
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+        }
+    }
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int get() const noexcept { return m_fd; }
+    // 关闭并返回是否成功（写入错误可能在 close 时才报告）
+    bool close() noexcept
+    {
+        const int fd = m_fd;
+        m_fd = -1;
+        return ::close(fd) == 0;
+    }
+
+   private:
+    int m_fd;
+};
+
+// 该错误表示这种拷贝方式在这对文件系统上不可用，按设备记下后不再尝试
+bool unsupported(int error)
+{
+    return error == EXDEV || error == ENOSYS || error == EOPNOTSUPP || error == ENOTTY;
+}
+
+// 只是这个文件不能用这种方式（只可追加或不可变的文件、个别 copy_file_range 的 EINVAL 等），
+// 本文件改用下一种方式，不影响之后的文件
+bool unsupportedForFile(int error)
+{
+    return error == EPERM || error == EINVAL || error == ESPIPE;
+}
+
+CopyEngine::Method nextMethod(CopyEngine::Method method)
+{
+    return static_cast<CopyEngine::Method>(static_cast<int>(method) + 1);
+}
+
+std::string errorText(const std::string& what, const std::string& path)
+{
+    return what + " " + path + ": " + std::strerror(errno);
+}
+
+// 读满 size 字节或到达文件末尾，返回读到的字节数
+std::size_t readAt(int fd, char* buffer, std::size_t size, uint64_t offset, const std::string& path)
+{
+    std::size_t done = 0;
+    while (done < size)
+    {
+        const auto count = ::pread(fd, buffer + done, size - done, static_cast<off_t>(offset + done));
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count < 0)
+        {
+            throw std::runtime_error(errorText("failed to read", path));
+        }
+        if (count == 0)
+        {
+            break;
+        }
+        done += static_cast<std::size_t>(count);
+    }
+    return done;
+}
+
+void writeAt(int fd, const char* buffer, std::size_t size, uint64_t offset, const std::string& path)
+{
+    for (std::size_t done = 0; done < size;)
+    {
+        const auto count = ::pwrite(fd, buffer + done, size - done, static_cast<off_t>(offset + done));
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            throw std::runtime_error(errorText("failed to write", path));
+        }
+        done += static_cast<std::size_t>(count);
+    }
+}
+
+// 用内核拷贝把源文件 offset 处最多 size 字节写到目标文件的同一位置，返回拷贝的字节数；
+// 返回 -1 表示这种方式不可用，原因在 errno 中
+int64_t kernelCopy(CopyEngine::Method method, int in, int out, uint64_t offset, std::size_t size)
+{
+    while (true)
+    {
+        ssize_t count = -1;
+        if (method == CopyEngine::Method::CopyRange)
+        {
+            loff_t inOffset = static_cast<loff_t>(offset);
+            loff_t outOffset = static_cast<loff_t>(offset);
+            count = ::copy_file_range(in, &inOffset, out, &outOffset, size, 0);
+        }
+        else
+        {
+            // sendfile 写到目标文件的当前位置
+            off_t inOffset = static_cast<off_t>(offset);
+            if (::lseek(out, static_cast<off_t>(offset), SEEK_SET) < 0)
+            {
+                return -1;
+            }
+            count = ::sendfile(out, in, &inOffset, size);
+        }
+        if (count >= 0)
+        {
+            return count;
+        }
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if (unsupported(errno) || unsupportedForFile(errno))
+        {
+            return -1;
+        }
+        throw std::runtime_error(std::string(CopyEngine::name(method)) +
+                                 " failed: " + std::strerror(errno));
+    }
+}
+#endif
+}  // namespace
+
+const char* CopyEngine::name(Method method) noexcept
+{
+    switch (method)
+    {
+        case Method::Clone:
+            return "clone";
+        case Method::CopyRange:
+            return "copy_file_range";
+        case Method::Sendfile:
+            return "sendfile";
+        case Method::Buffered:
+            break;
+    }
+    return "buffered";
+}
+
+CopyEngine& CopyEngine::instance()
+{
+    static CopyEngine engine(
+        []
+        {
+            const auto configured = Config::instance().getString("copy.engine", "auto");
+            for (const auto method : {Method::Clone, Method::CopyRange, Method::Sendfile})
+            {
+                if (configured == name(method))
+                {
+                    return method;
+                }
+            }
+            return configured == "buffered" ? Method::Buffered : Method::Clone;
+        }());
+    return engine;
+}
+
+CopyEngine::Method CopyEngine::methodFor(uint64_t sourceDevice, uint64_t targetDevice)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_methods.emplace(std::make_pair(sourceDevice, targetDevice), m_fastest).first->second;
+}
+
+CopyEngine::Method CopyEngine::demote(uint64_t sourceDevice, uint64_t targetDevice, Method failed)
+{
+    const auto next = static_cast<Method>(static_cast<int>(failed) + 1);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& method = m_methods[std::make_pair(sourceDevice, targetDevice)];
+    // 其他线程可能已经降到更慢的方式
+    if (static_cast<int>(method) < static_cast<int>(next))
+    {
+        method = next;
+    }
+    return method;
+}
+
+std::string CopyEngine::summary() const
+{
+    std::string text;
+    for (const auto method : {Method::Clone, Method::CopyRange, Method::Sendfile, Method::Buffered})
+    {
+        text += std::string(text.empty() ? "" : " ") + name(method) + ":" +
+                std::to_string(m_files[static_cast<int>(method)].load());
+    }
+    return text;
+}
+
+std::string CopyEngine::copy(const std::string& source, const std::string& dest, Digest& digest,
+                             Digest* sample)
+{
+#ifdef __linux__
+    FileDescriptor in(::open(source.c_str(), O_RDONLY | O_CLOEXEC));
+    if (in.get() < 0)
+    {
+        throw std::runtime_error(errorText("cannot open source file", source));
+    }
+    // 读回目标文件计算摘要，所以以读写方式打开
+    FileDescriptor out(::open(dest.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if (out.get() < 0)
+    {
+        throw std::runtime_error(errorText("cannot create target file", dest));
+    }
+    struct stat sourceStat;
+    struct stat targetStat;
+    if (::fstat(in.get(), &sourceStat) != 0 || ::fstat(out.get(), &targetStat) != 0)
+    {
+        throw std::runtime_error(errorText("cannot stat", source));
+    }
+    const auto sourceDevice = static_cast<uint64_t>(sourceStat.st_dev);
+    const auto targetDevice = static_cast<uint64_t>(targetStat.st_dev);
+    auto method = methodFor(sourceDevice, targetDevice);
+
+    std::vector<char> buffer(copyBlockSize);
+    auto update = [&](std::size_t count)
+    {
+        digest.update(buffer.data(), count);
+        if (sample != nullptr)
+        {
+            sample->update(buffer.data(), count);
+        }
+    };
+    uint64_t offset = 0;
+    if (method == Method::Clone)
+    {
+        if (::ioctl(out.get(), FICLONE, in.get()) == 0)
+        {
+            // 目标文件与源文件共用数据，读回即为源文件此刻的内容
+            while (const auto count = readAt(out.get(), buffer.data(), buffer.size(), offset, dest))
+            {
+                update(count);
+                offset += count;
+            }
+        }
+        else if (unsupported(errno))
+        {
+            method = demote(sourceDevice, targetDevice, Method::Clone);
+        }
+        else if (unsupportedForFile(errno))
+        {
+            method = nextMethod(Method::Clone);
+        }
+        else
+        {
+            throw std::runtime_error(errorText("clone failed", dest));
+        }
+    }
+    if (method != Method::Clone)
+    {
+        while (true)
+        {
+            std::size_t count = 0;
+            if (method != Method::Buffered)
+            {
+                const auto copied =
+                    kernelCopy(method, in.get(), out.get(), offset, buffer.size());
+                if (copied < 0)
+                {
+                    method = unsupported(errno) ? demote(sourceDevice, targetDevice, method)
+                                                : nextMethod(method);
+                    continue;
+                }
+                if (copied == 0)
+                {
+                    // 源文件可能在拷贝途中被截断，重新取大小后已读到末尾就是正常结束；
+                    // 否则是个别文件系统对 copy_file_range 返回 0 而不报错，只对这个文件换方式
+                    if (::fstat(in.get(), &sourceStat) != 0)
+                    {
+                        throw std::runtime_error(errorText("cannot stat", source));
+                    }
+                    if (offset >= static_cast<uint64_t>(sourceStat.st_size))
+                    {
+                        break;
+                    }
+                    method = nextMethod(method);
+                    continue;
+                }
+                count = readAt(out.get(), buffer.data(), static_cast<std::size_t>(copied), offset,
+                               dest);
+                if (count != static_cast<std::size_t>(copied))
+                {
+                    throw std::runtime_error("target file shorter than copied: " + dest);
+                }
+            }
+            else
+            {
+                count = readAt(in.get(), buffer.data(), buffer.size(), offset, source);
+                if (count == 0)
+                {
+                    break;
+                }
+                writeAt(out.get(), buffer.data(), count, offset, dest);
+            }
+            update(count);
+            offset += count;
+        }
+    }
+    if (!out.close())
+    {
+        throw std::runtime_error(errorText("failed to write target file", dest));
+    }
+    ++m_files[static_cast<int>(method)];
+    return digest.hexFinal();
+#else
+    auto hex = Utils::copyFileWithDigest(source, dest, digest, sample);
+    ++m_files[static_cast<int>(Method::Buffered)];
+    return hex;
+#endif
+}
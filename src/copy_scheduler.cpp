@@ -0,0 +1,148 @@
+#include "copy_scheduler.h"
+
+#include <algorithm>
+#include <exception>
+
+#include "util.h"
+
+namespace
+{
+Utils::Log& schedulerLog()
+{
+    static Utils::Log log;
+    return log;
+}
+}  // namespace
+
+CopyScheduler::CopyScheduler(unsigned workers, unsigned perQueue, std::size_t maxQueued)
+    : m_perQueue(std::max(1u, perQueue)), m_maxQueued(std::max<std::size_t>(1, maxQueued))
+{
+    for (unsigned i = 0; i < std::max(1u, workers); ++i)
+    {
+        m_workers.emplace_back(&CopyScheduler::worker, this);
+    }
+}
+
+CopyScheduler::~CopyScheduler()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_doneCv.wait(lock, [this]() { return m_unfinished == 0; });
+        m_stop = true;
+    }
+    m_workCv.notify_all();
+    for (auto& thread : m_workers)
+    {
+        thread.join();
+    }
+}
+
+void CopyScheduler::submit(int queue, uint64_t bytes, Task work, Task done)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_doneCv.wait(lock, [this]() { return m_queued < m_maxQueued; });
+        auto& target = m_queues[queue];
+        target.items.push_back({bytes, std::move(work), std::move(done)});
+        target.pendingBytes += bytes;
+        ++m_queued;
+        ++m_unfinished;
+    }
+    // 空闲线程可能都在等别的队列让出名额，全部唤醒重新挑选
+    m_workCv.notify_all();
+}
+
+void CopyScheduler::drain(bool wait)
+{
+    while (true)
+    {
+        std::deque<Task> done;
+        bool finished = false;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (wait)
+            {
+                m_doneCv.wait(lock, [this]() { return !m_done.empty() || m_unfinished == 0; });
+            }
+            done.swap(m_done);
+            finished = m_unfinished == 0;
+        }
+        for (auto& task : done)
+        {
+            task();
+        }
+        if (!wait || (finished && done.empty()))
+        {
+            return;
+        }
+    }
+}
+
+uint64_t CopyScheduler::pendingBytes(int queue) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto it = m_queues.find(queue);
+    return it == m_queues.end() ? 0 : it->second.pendingBytes;
+}
+
+std::map<int, CopyScheduler::Queue>::iterator CopyScheduler::nextRunnable()
+{
+    auto runnable = [this](const auto& entry)
+    { return !entry.second.items.empty() && entry.second.running < m_perQueue; };
+    const auto start = m_queues.upper_bound(m_lastQueue);
+    auto it = std::find_if(start, m_queues.end(), runnable);
+    if (it == m_queues.end())
+    {
+        it = std::find_if(m_queues.begin(), start, runnable);
+        if (it == start)
+        {
+            return m_queues.end();
+        }
+    }
+    return it;
+}
+
+void CopyScheduler::worker()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        auto it = m_queues.end();
+        m_workCv.wait(lock,
+                      [&]()
+                      {
+                          it = nextRunnable();
+                          return m_stop || it != m_queues.end();
+                      });
+        if (it == m_queues.end())
+        {
+            return;
+        }
+        m_lastQueue = it->first;
+        auto& queue = it->second;
+        auto item = std::move(queue.items.front());
+        queue.items.pop_front();
+        ++queue.running;
+        --m_queued;
+        m_doneCv.notify_all();
+        lock.unlock();
+
+        // work 自行记录错误；漏出的异常不能终止进程，记下后照常完成
+        try
+        {
+            item.work();
+        }
+        catch (const std::exception& e)
+        {
+            schedulerLog().error(std::string("copy task failed: ") + e.what());
+        }
+
+        lock.lock();
+        --queue.running;
+        queue.pendingBytes -= item.bytes;
+        m_done.push_back(std::move(item.done));
+        --m_unfinished;
+        m_doneCv.notify_all();
+        m_workCv.notify_all();
+    }
+}
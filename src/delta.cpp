@@ -0,0 +1,450 @@
+#include "delta.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include "hasher.h"
+
+namespace
+{
+// 补丁格式（整数均为小端）：
+//   头部    "TMDELTA1" u32 块大小 u64 旧版本大小
+//   拷贝    'C' u64 旧版本中的偏移 u64 长度
+//   字面    'L' u64 长度 + 数据
+//   结尾    'E' u64 新内容总长度
+constexpr char patchMagic[8] = {'T', 'M', 'D', 'E', 'L', 'T', 'A', '1'};
+constexpr std::size_t maxLiteral = 1 << 20;
+constexpr std::size_t filterBits = 1 << 20;
+
+void putU32(unsigned char* out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+
+void putU64(unsigned char* out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+
+uint32_t getU32(const unsigned char* in)
+{
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; --i)
+    {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+uint64_t getU64(const unsigned char* in)
+{
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i)
+    {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+// murmur3-128 的十六进制结果转成两个 64 位整数
+std::array<uint64_t, 2> strongOf(Digest& digest, const unsigned char* data, std::size_t size)
+{
+    digest.update(data, size);
+    const auto hex = digest.hexFinal();
+    std::array<uint64_t, 2> value{};
+    for (std::size_t i = 0; i < hex.size() && i < 32; ++i)
+    {
+        const char c = hex[i];
+        const uint64_t nibble = c <= '9' ? c - '0' : c - 'a' + 10;
+        value[i / 16] = (value[i / 16] << 4) | nibble;
+    }
+    return value;
+}
+
+// rsync 滚动校验和：a 为字节和，b 为 a 的前缀和，各取低 16 位
+void weakOf(const unsigned char* data, std::size_t size, uint32_t& a, uint32_t& b)
+{
+    a = 0;
+    b = 0;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        a += data[i];
+        b += a;
+    }
+}
+
+inline uint32_t weakValue(uint32_t a, uint32_t b)
+{
+    return (a & 0xffff) | (b << 16);
+}
+
+inline std::size_t filterIndex(uint32_t weak)
+{
+    return (weak * 2654435761u) >> 12;
+}
+
+void readExact(std::istream& in, unsigned char* out, std::size_t size, const char* what)
+{
+    if (!in.read(reinterpret_cast<char*>(out), static_cast<std::streamsize>(size)))
+    {
+        throw std::runtime_error(std::string("truncated ") + what);
+    }
+}
+}  // namespace
+
+std::vector<unsigned char> Delta::Signature::serialize() const
+{
+    std::vector<unsigned char> out(16 + weak.size() * 20);
+    putU32(out.data(), blockSize);
+    putU64(out.data() + 4, fileSize);
+    putU32(out.data() + 12, static_cast<uint32_t>(weak.size()));
+    auto* p = out.data() + 16;
+    for (std::size_t i = 0; i < weak.size(); ++i, p += 20)
+    {
+        putU32(p, weak[i]);
+        putU64(p + 4, strong[i][0]);
+        putU64(p + 12, strong[i][1]);
+    }
+    return out;
+}
+
+bool Delta::Signature::parse(const void* data, std::size_t size, Signature& out)
+{
+    const auto* in = static_cast<const unsigned char*>(data);
+    if (in == nullptr || size < 16)
+    {
+        return false;
+    }
+    const auto blocks = getU32(in + 12);
+    if (size != 16 + static_cast<std::size_t>(blocks) * 20)
+    {
+        return false;
+    }
+    out.blockSize = getU32(in);
+    out.fileSize = getU64(in + 4);
+    if (out.blockSize == 0 ||
+        (out.fileSize + out.blockSize - 1) / out.blockSize != static_cast<uint64_t>(blocks))
+    {
+        return false;
+    }
+    out.weak.resize(blocks);
+    out.strong.resize(blocks);
+    const auto* p = in + 16;
+    for (std::size_t i = 0; i < blocks; ++i, p += 20)
+    {
+        out.weak[i] = getU32(p);
+        out.strong[i] = {getU64(p + 4), getU64(p + 12)};
+    }
+    return true;
+}
+
+Delta::SignatureBuilder::SignatureBuilder(uint32_t blockSize)
+    : m_blockSize(blockSize), m_strong(Digest::create("murmur3-128"))
+{
+    m_pending.reserve(blockSize);
+    m_signature.blockSize = blockSize;
+}
+
+Delta::SignatureBuilder::~SignatureBuilder() = default;
+
+void Delta::SignatureBuilder::update(const void* data, std::size_t size)
+{
+    const auto* p = static_cast<const unsigned char*>(data);
+    m_signature.fileSize += size;
+    while (size > 0)
+    {
+        // 缓冲为空时整块直接计算，不再拷贝
+        if (m_pending.empty() && size >= m_blockSize)
+        {
+            addBlock(p, m_blockSize);
+            p += m_blockSize;
+            size -= m_blockSize;
+            continue;
+        }
+        const auto count = std::min<std::size_t>(size, m_blockSize - m_pending.size());
+        m_pending.insert(m_pending.end(), p, p + count);
+        p += count;
+        size -= count;
+        if (m_pending.size() == m_blockSize)
+        {
+            addBlock(m_pending.data(), m_pending.size());
+            m_pending.clear();
+        }
+    }
+}
+
+Delta::Signature Delta::SignatureBuilder::finish()
+{
+    if (!m_pending.empty())
+    {
+        addBlock(m_pending.data(), m_pending.size());
+        m_pending.clear();
+    }
+    Signature result = std::move(m_signature);
+    m_signature = Signature();
+    m_signature.blockSize = m_blockSize;
+    return result;
+}
+
+void Delta::SignatureBuilder::addBlock(const unsigned char* data, std::size_t size)
+{
+    uint32_t a = 0;
+    uint32_t b = 0;
+    weakOf(data, size, a, b);
+    m_signature.weak.push_back(weakValue(a, b));
+    m_signature.strong.push_back(strongOf(*m_strong, data, size));
+}
+
+Delta::Encoder::Encoder(const Signature& basis, Sink sink)
+    : m_basis(basis),
+      m_sink(std::move(sink)),
+      m_strong(Digest::create("murmur3-128")),
+      m_blockSize(basis.blockSize),
+      m_filter(filterBits)
+{
+    const auto fullBlocks = static_cast<std::size_t>(basis.fileSize / basis.blockSize);
+    for (std::size_t i = 0; i < fullBlocks && i < basis.weak.size(); ++i)
+    {
+        m_blocks[basis.weak[i]].push_back(static_cast<uint32_t>(i));
+        m_filter[filterIndex(basis.weak[i])] = true;
+    }
+    unsigned char header[20];
+    std::memcpy(header, patchMagic, sizeof(patchMagic));
+    putU32(header + 8, basis.blockSize);
+    putU64(header + 12, basis.fileSize);
+    write(header, sizeof(header));
+}
+
+Delta::Encoder::~Encoder() = default;
+
+void Delta::Encoder::update(const void* data, std::size_t size)
+{
+    const auto* p = static_cast<const unsigned char*>(data);
+    m_buffer.insert(m_buffer.end(), p, p + size);
+    process(false);
+}
+
+void Delta::Encoder::finish()
+{
+    process(true);
+    unsigned char trailer[9];
+    trailer[0] = 'E';
+    putU64(trailer + 1, m_outputSize);
+    write(trailer, sizeof(trailer));
+}
+
+void Delta::Encoder::process(bool final)
+{
+    const std::size_t block = m_blockSize;
+    while (m_buffer.size() - m_window >= block)
+    {
+        if (!m_weakValid)
+        {
+            weakOf(m_buffer.data() + m_window, block, m_a, m_b);
+            m_weakValid = true;
+        }
+        uint32_t index = 0;
+        if (findMatch(index))
+        {
+            emitLiteral(m_window);
+            emitCopy(static_cast<uint64_t>(index) * block, block);
+            m_nextBlock = index + 1;
+            m_window += block;
+            m_literal = m_window;
+            m_weakValid = false;
+            continue;
+        }
+        // 需要窗口后的下一个字节才能滑动
+        if (m_window + block >= m_buffer.size())
+        {
+            break;
+        }
+        const uint32_t out = m_buffer[m_window];
+        const uint32_t in = m_buffer[m_window + block];
+        m_a = m_a - out + in;
+        m_b = m_b - static_cast<uint32_t>(block) * out + m_a;
+        ++m_window;
+        if (m_window - m_literal >= maxLiteral)
+        {
+            emitLiteral(m_window);
+        }
+    }
+    if (final)
+    {
+        emitLiteral(m_buffer.size());
+        flushCopy();
+        m_window = m_buffer.size();
+    }
+    // 已输出的数据移出缓冲
+    if (m_literal >= maxLiteral || (final && m_literal > 0))
+    {
+        m_buffer.erase(m_buffer.begin(), m_buffer.begin() + static_cast<std::ptrdiff_t>(m_literal));
+        m_window -= m_literal;
+        m_literal = 0;
+    }
+}
+
+bool Delta::Encoder::findMatch(uint32_t& block)
+{
+    const auto weak = weakValue(m_a, m_b);
+    if (!m_filter[filterIndex(weak)])
+    {
+        return false;
+    }
+    const auto it = m_blocks.find(weak);
+    if (it == m_blocks.end())
+    {
+        return false;
+    }
+    const auto strong = strongOf(*m_strong, m_buffer.data() + m_window, m_blockSize);
+    bool found = false;
+    for (const auto candidate : it->second)
+    {
+        if (m_basis.strong[candidate] != strong)
+        {
+            continue;
+        }
+        if (!found || candidate == m_nextBlock)
+        {
+            block = candidate;
+            found = true;
+        }
+        if (candidate == m_nextBlock)
+        {
+            break;
+        }
+    }
+    return found;
+}
+
+void Delta::Encoder::emitLiteral(std::size_t end)
+{
+    if (end <= m_literal)
+    {
+        return;
+    }
+    flushCopy();
+    const auto size = end - m_literal;
+    unsigned char op[9];
+    op[0] = 'L';
+    putU64(op + 1, size);
+    write(op, sizeof(op));
+    write(m_buffer.data() + m_literal, size);
+    m_literalBytes += size;
+    m_outputSize += size;
+    m_literal = end;
+}
+
+void Delta::Encoder::emitCopy(uint64_t offset, uint64_t size)
+{
+    m_copiedBytes += size;
+    if (m_copySize != 0 && m_copyOffset + m_copySize == offset)
+    {
+        m_copySize += size;
+        return;
+    }
+    flushCopy();
+    m_copyOffset = offset;
+    m_copySize = size;
+}
+
+void Delta::Encoder::flushCopy()
+{
+    if (m_copySize == 0)
+    {
+        return;
+    }
+    unsigned char op[17];
+    op[0] = 'C';
+    putU64(op + 1, m_copyOffset);
+    putU64(op + 9, m_copySize);
+    write(op, sizeof(op));
+    m_outputSize += m_copySize;
+    m_copySize = 0;
+}
+
+void Delta::Encoder::write(const void* data, std::size_t size)
+{
+    m_sink(data, size);
+    m_patchBytes += size;
+}
+
+uint64_t Delta::apply(std::istream& patch, const std::string& basisPath, const Sink& sink)
+{
+    unsigned char header[20];
+    readExact(patch, header, sizeof(header), "patch header");
+    if (std::memcmp(header, patchMagic, sizeof(patchMagic)) != 0)
+    {
+        throw std::runtime_error("not a delta patch");
+    }
+    const auto basisSize = getU64(header + 12);
+    std::ifstream basis(std::filesystem::u8path(basisPath), std::ifstream::binary);
+    std::error_code ec;
+    if (!basis || std::filesystem::file_size(std::filesystem::u8path(basisPath), ec) != basisSize ||
+        ec)
+    {
+        throw std::runtime_error("basis of delta missing or size mismatch: " + basisPath);
+    }
+
+    std::vector<unsigned char> buffer(maxLiteral);
+    uint64_t produced = 0;
+    auto pipe = [&](std::istream& in, uint64_t size, const char* what)
+    {
+        while (size > 0)
+        {
+            const auto count = static_cast<std::size_t>(std::min<uint64_t>(size, buffer.size()));
+            readExact(in, buffer.data(), count, what);
+            sink(buffer.data(), count);
+            size -= count;
+            produced += count;
+        }
+    };
+    while (true)
+    {
+        unsigned char op = 0;
+        readExact(patch, &op, 1, "patch");
+        if (op == 'C')
+        {
+            unsigned char args[16];
+            readExact(patch, args, sizeof(args), "patch");
+            const auto offset = getU64(args);
+            const auto size = getU64(args + 8);
+            if (offset > basisSize || size > basisSize - offset)
+            {
+                throw std::runtime_error("delta copies beyond the end of its basis");
+            }
+            basis.clear();
+            basis.seekg(static_cast<std::streamoff>(offset));
+            pipe(basis, size, "basis");
+        }
+        else if (op == 'L')
+        {
+            unsigned char args[8];
+            readExact(patch, args, sizeof(args), "patch");
+            pipe(patch, getU64(args), "patch");
+        }
+        else if (op == 'E')
+        {
+            unsigned char args[8];
+            readExact(patch, args, sizeof(args), "patch");
+            if (getU64(args) != produced)
+            {
+                throw std::runtime_error("delta output size mismatch");
+            }
+            return produced;
+        }
+        else
+        {
+            throw std::runtime_error("corrupt delta patch");
+        }
+    }
+}
@@ -0,0 +1,519 @@
+#include "file_scanner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <cerrno>
+#else
+#include "util.h"
+#endif
+
+namespace
+{
+// 目录项名称是否会让完整路径命中 isHiddenPath
+bool isHiddenName(std::string_view name)
+{
+    return (!name.empty() && name.front() == '.') || name.find("\\.") != std::string_view::npos;
+}
+
+#ifdef __linux__
+[[noreturn]] void throwSystemError(const char* what, const std::string& path)
+{
+    throw std::filesystem::filesystem_error(what, std::filesystem::u8path(path),
+                                            std::error_code(errno, std::generic_category()));
+}
+
+std::string joinPath(const std::string& dir, std::string_view name)
+{
+    std::string path;
+    path.reserve(dir.size() + name.size() + 1);
+    path.append(dir);
+    if (path.empty() || path.back() != '/')
+    {
+        path.push_back('/');
+    }
+    path.append(name);
+    return path;
+}
+
+// 跟随符号链接取文件信息；文件在扫描过程中消失时返回 false
+bool statAt(int dirFd, const char* name, const std::string& path,
+            timemachine::FileRecord& record, bool& isRegular)
+{
+#ifdef STATX_TYPE
+    // AT_STATX_DONT_SYNC：网络文件系统上直接使用本地缓存的属性，避免逐个文件往返服务器
+    struct statx stx;
+    if (::statx(dirFd, name, AT_STATX_DONT_SYNC,
+                STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_CTIME | STATX_INO, &stx) != 0)
+    {
+        if (errno == ENOENT)
+        {
+            return false;
+        }
+        throwSystemError("statx", path);
+    }
+    isRegular = S_ISREG(stx.stx_mode);
+    record.filesize = static_cast<int64_t>(stx.stx_size);
+    record.motifytime = static_cast<int64_t>(stx.stx_mtime.tv_sec) * 1000 +
+                        stx.stx_mtime.tv_nsec / 1000000;
+    record.inode = stx.stx_ino;
+    record.device = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    record.changetime =
+        static_cast<int64_t>(stx.stx_ctime.tv_sec) * 1000000000 + stx.stx_ctime.tv_nsec;
+#else
+    struct stat st;
+    if (::fstatat(dirFd, name, &st, 0) != 0)
+    {
+        if (errno == ENOENT)
+        {
+            return false;
+        }
+        throwSystemError("fstatat", path);
+    }
+    isRegular = S_ISREG(st.st_mode);
+    record.filesize = static_cast<int64_t>(st.st_size);
+    record.motifytime =
+        static_cast<int64_t>(st.st_mtim.tv_sec) * 1000 + st.st_mtim.tv_nsec / 1000000;
+    record.inode = st.st_ino;
+    record.device = st.st_dev;
+    record.changetime = static_cast<int64_t>(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+#endif
+    return true;
+}
+#endif
+}  // namespace
+
+FileScanner::FileScanner(unsigned threadCount, std::size_t bufferLimit)
+    : m_threadCount(threadCount), m_bufferLimit(std::max<std::size_t>(1, bufferLimit))
+{
+    if (m_threadCount == 0)
+    {
+        m_threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+bool FileScanner::statFile(const std::string& path, timemachine::FileRecord& record)
+{
+#ifdef __linux__
+    bool isRegular = false;
+    try
+    {
+        if (!statAt(AT_FDCWD, path.c_str(), path, record, isRegular) || !isRegular)
+        {
+            return false;
+        }
+    }
+    catch (const std::filesystem::filesystem_error&)
+    {
+        return false;
+    }
+    record.path = path;
+    return true;
+#else
+    (void)path;
+    (void)record;
+    return false;
+#endif
+}
+
+bool FileScanner::isHiddenPath(const std::string& path)
+{
+    return path.find("/.") != std::string::npos || path.find("\\.") != std::string::npos;
+}
+
+void FileScanner::scan(const std::string& rootPath,
+                       std::vector<timemachine::FileRecord>& fileList)
+{
+    scan(rootPath,
+         [&fileList](timemachine::FileRecord& file)
+         {
+             fileList.emplace_back(std::move(file));
+             return true;
+         });
+}
+
+bool FileScanner::scan(const std::string& rootPath, const Sink& sink)
+{
+    // 根路径本身是隐藏路径时，其下所有文件都会被过滤
+    if (isHiddenPath(rootPath))
+    {
+        m_pending = 0;
+        return true;
+    }
+
+    auto root = std::make_shared<DirNode>();
+    root->path = std::filesystem::u8path(rootPath).u8string();
+
+    // 最后一个队列属于调用线程（遍历时可能就地列出尚未被领取的目录）
+    m_queues.clear();
+    for (unsigned i = 0; i <= m_threadCount; ++i)
+    {
+        m_queues.emplace_back(std::make_unique<WorkQueue>());
+    }
+    m_stop = false;
+    m_error = nullptr;
+    m_listed = 0;
+    m_buffered = 0;
+    m_pending = 1;
+    m_queues.front()->tasks.push_back(root);
+
+    std::vector<std::thread> threads;
+    threads.reserve(m_threadCount);
+    for (unsigned i = 0; i < m_threadCount; ++i)
+    {
+        threads.emplace_back(&FileScanner::worker, this, i);
+    }
+
+    bool completed = true;
+    try
+    {
+        // 显式栈做先序遍历，避免目录很深时递归爆栈
+        std::vector<std::pair<std::shared_ptr<DirNode>, std::size_t>> stack;
+        if (waitListed(*root))
+        {
+            stack.emplace_back(std::move(root), 0);
+        }
+        while (!stack.empty())
+        {
+            auto& [node, pos] = stack.back();
+            if (pos == node->entries.size())
+            {
+                stack.pop_back();
+                continue;
+            }
+            auto& item = node->entries[pos++];
+            if (m_buffered.fetch_sub(1) == m_bufferLimit)
+            {
+                std::lock_guard<std::mutex> lock(m_spaceMutex);
+                m_spaceCv.notify_all();
+            }
+
+            if (item.dir)
+            {
+                auto child = std::move(item.dir);
+                if (!waitListed(*child))
+                {
+                    break;
+                }
+                stack.emplace_back(std::move(child), 0);
+            }
+            else if (!sink(item.file))
+            {
+                completed = false;
+                break;
+            }
+        }
+    }
+    catch (...)
+    {
+        stopWorkers(threads);
+        throw;
+    }
+    stopWorkers(threads);
+
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+    return completed;
+}
+
+void FileScanner::stopWorkers(std::vector<std::thread>& threads)
+{
+    m_stop = true;
+    {
+        std::lock_guard<std::mutex> lock(m_spaceMutex);
+        m_spaceCv.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_idleMutex);
+        m_idleCv.notify_all();
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    threads.clear();
+}
+
+void FileScanner::worker(std::size_t index)
+{
+    while (!m_stop)
+    {
+        {
+            // 回调跟不上时暂停领取新目录
+            std::unique_lock<std::mutex> lock(m_spaceMutex);
+            m_spaceCv.wait(lock, [this] { return m_stop || m_buffered < m_bufferLimit; });
+        }
+        if (m_stop)
+        {
+            break;
+        }
+
+        auto node = takeTask(index);
+        if (!node)
+        {
+            std::unique_lock<std::mutex> lock(m_idleMutex);
+            m_idleCv.wait_for(lock, std::chrono::milliseconds(2));
+            continue;
+        }
+        if (claim(*node))
+        {
+            processNode(index, *node);
+        }
+    }
+}
+
+bool FileScanner::claim(DirNode& node)
+{
+    auto expected = NodeState::Queued;
+    return node.state.compare_exchange_strong(expected, NodeState::Listing);
+}
+
+void FileScanner::processNode(std::size_t index, DirNode& node)
+{
+    try
+    {
+        listDirectory(index, node);
+        sortEntries(node);
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(m_errorMutex);
+        if (!m_error)
+        {
+            m_error = std::current_exception();
+        }
+        m_stop = true;
+    }
+
+    m_buffered += node.entries.size();
+    --m_pending;
+    {
+        std::lock_guard<std::mutex> lock(m_doneMutex);
+        node.state = NodeState::Done;
+    }
+    m_doneCv.notify_all();
+}
+
+void FileScanner::sortEntries(DirNode& node)
+{
+    // 目录按“名称 + 分隔符”参与排序：子目录下的所有路径都以该前缀开头，
+    // 因此先序遍历输出的完整路径恰好按字节序递增，与 SQLite 的 order by filepath 相同
+    constexpr auto separator = static_cast<unsigned char>(
+        std::filesystem::path::preferred_separator);
+    auto less = [separator](const Entry& a, const Entry& b)
+    {
+        const std::string& pa = a.dir ? a.dir->path : a.file.path;
+        const std::string& pb = b.dir ? b.dir->path : b.file.path;
+        const auto n = std::min(pa.size(), pb.size());
+        if (const int r = pa.compare(0, n, pb, 0, n); r != 0)
+        {
+            return r < 0;
+        }
+        // 一方是另一方的前缀：较短一方接下来的字符是分隔符（目录）或字符串结尾（文件）
+        if (pa.size() == pb.size())
+        {
+            return !a.dir && b.dir;
+        }
+        if (pa.size() < pb.size())
+        {
+            return !a.dir || separator < static_cast<unsigned char>(pb[n]);
+        }
+        return b.dir && static_cast<unsigned char>(pa[n]) < separator;
+    };
+    std::sort(node.entries.begin(), node.entries.end(), less);
+}
+
+bool FileScanner::waitListed(DirNode& node)
+{
+    // 还没有工作线程领取时由调用线程直接列出，保证遍历不会因背压而卡住
+    if (claim(node))
+    {
+        processNode(m_queues.size() - 1, node);
+    }
+    else
+    {
+        std::unique_lock<std::mutex> lock(m_doneMutex);
+        m_doneCv.wait(lock, [&] { return m_stop || node.state == NodeState::Done; });
+    }
+    return m_error == nullptr;
+}
+
+std::shared_ptr<FileScanner::DirNode> FileScanner::takeTask(std::size_t index)
+{
+    // 先从自己的队尾取（深度优先，局部性好）
+    {
+        auto& own = *m_queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            auto node = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return node;
+        }
+    }
+    // 再从其他队列的队首窃取（通常是较浅、较大的子树）
+    for (std::size_t i = 1; i < m_queues.size(); ++i)
+    {
+        auto& victim = *m_queues[(index + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            auto node = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return node;
+        }
+    }
+    return nullptr;
+}
+
+void FileScanner::pushTask(std::size_t index, std::shared_ptr<DirNode> node)
+{
+    ++m_pending;
+    auto& own = *m_queues[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    own.tasks.push_back(std::move(node));
+}
+
+#ifdef __linux__
+void FileScanner::listDirectory(std::size_t index, DirNode& node)
+{
+    const int dirFd = ::open(node.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0)
+    {
+        throwSystemError("open", node.path);
+    }
+    DIR* dir = ::fdopendir(dirFd);
+    if (dir == nullptr)
+    {
+        const int err = errno;
+        ::close(dirFd);
+        errno = err;
+        throwSystemError("fdopendir", node.path);
+    }
+    std::unique_ptr<DIR, int (*)(DIR*)> dirGuard(dir, ::closedir);
+
+    std::vector<std::shared_ptr<DirNode>> children;
+    while (true)
+    {
+        errno = 0;
+        const dirent* ent = ::readdir(dir);
+        if (ent == nullptr)
+        {
+            if (errno != 0)
+            {
+                throwSystemError("readdir", node.path);
+            }
+            break;
+        }
+        const std::string_view name(ent->d_name);
+        if (name == "." || name == ".." || isHiddenName(name))
+        {
+            continue;
+        }
+
+        bool isDir = ent->d_type == DT_DIR;
+        if (ent->d_type == DT_UNKNOWN)
+        {
+            // 部分文件系统不填 d_type，需要 lstat 一次
+            struct stat lst;
+            if (::fstatat(dirFd, ent->d_name, &lst, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+                continue;
+            }
+            isDir = S_ISDIR(lst.st_mode);
+        }
+
+        Entry item;
+        if (isDir)
+        {
+            item.dir = std::make_shared<DirNode>();
+            item.dir->path = joinPath(node.path, name);
+            children.push_back(item.dir);
+        }
+        else
+        {
+            // 符号链接跟随到目标；指向目录的链接、设备、管道等非普通文件不备份
+            item.file.path = joinPath(node.path, name);
+            bool isRegular = false;
+            if (!statAt(dirFd, ent->d_name, item.file.path, item.file, isRegular) ||
+                !isRegular)
+            {
+                continue;
+            }
+        }
+        node.entries.emplace_back(std::move(item));
+    }
+
+    m_listed += node.entries.size() - children.size();
+    for (auto& child : children)
+    {
+        pushTask(index, std::move(child));
+    }
+    if (!children.empty())
+    {
+        m_idleCv.notify_all();
+    }
+}
+#else
+void FileScanner::listDirectory(std::size_t index, DirNode& node)
+{
+    std::vector<std::shared_ptr<DirNode>> children;
+    for (const auto& entry :
+         std::filesystem::directory_iterator(std::filesystem::u8path(node.path)))
+    {
+        const auto name = entry.path().filename().u8string();
+        if (isHiddenName(name))
+        {
+            continue;
+        }
+
+        Entry item;
+        if (entry.is_directory())
+        {
+            // 与 recursive_directory_iterator 一致：不跟随目录符号链接，也不输出目录本身
+            if (entry.is_symlink())
+            {
+                continue;
+            }
+            item.dir = std::make_shared<DirNode>();
+            item.dir->path = entry.path().u8string();
+            children.push_back(item.dir);
+        }
+        else if (entry.is_regular_file())
+        {
+            // Windows 下这些属性在列目录时已缓存，不产生额外系统调用
+            item.file.path = entry.path().u8string();
+            item.file.filesize = static_cast<int64_t>(entry.file_size());
+            item.file.motifytime = Utils::toMilliTimeStamp(entry.last_write_time());
+        }
+        else
+        {
+            continue;
+        }
+        node.entries.emplace_back(std::move(item));
+    }
+
+    m_listed += node.entries.size() - children.size();
+    for (auto& child : children)
+    {
+        pushTask(index, std::move(child));
+    }
+    if (!children.empty())
+    {
+        m_idleCv.notify_all();
+    }
+}
+#endif
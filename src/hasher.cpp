@@ -0,0 +1,675 @@
+#include "hasher.h"
+
+#include <openssl/evp.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+
+#include "config.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+namespace
+{
+constexpr std::size_t pageSize = 4096;
+
+unsigned char* alignedAlloc(std::size_t size)
+{
+#ifdef _WIN32
+    auto* p = static_cast<unsigned char*>(_aligned_malloc(size, pageSize));
+#else
+    auto* p = static_cast<unsigned char*>(std::aligned_alloc(pageSize, size));
+#endif
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+}  // namespace
+
+void hexEncode(const unsigned char* data, std::size_t size, char* out)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        out[2 * i] = digits[data[i] >> 4];
+        out[2 * i + 1] = digits[data[i] & 0x0f];
+    }
+}
+
+namespace
+{
+// OpenSSL 提供的算法
+class EvpDigest : public Digest
+{
+   public:
+    explicit EvpDigest(const EVP_MD* md) : m_md(md), m_ctx(EVP_MD_CTX_new())
+    {
+        if (m_md == nullptr || m_ctx == nullptr || EVP_DigestInit_ex(m_ctx, m_md, nullptr) != 1)
+        {
+            EVP_MD_CTX_free(m_ctx);
+            throw std::runtime_error("EVP_DigestInit_ex failed");
+        }
+    }
+    ~EvpDigest() override { EVP_MD_CTX_free(m_ctx); }
+
+    EvpDigest(const EvpDigest&) = delete;
+    EvpDigest& operator=(const EvpDigest&) = delete;
+
+    void update(const void* data, std::size_t size) override
+    {
+        EVP_DigestUpdate(m_ctx, data, size);
+    }
+
+    std::string hexFinal() override
+    {
+        unsigned char md[EVP_MAX_MD_SIZE];
+        unsigned int length = 0;
+        EVP_DigestFinal_ex(m_ctx, md, &length);
+        EVP_DigestInit_ex(m_ctx, m_md, nullptr);
+
+        std::string hex(length * 2, '\0');
+        hexEncode(md, length, hex.data());
+        return hex;
+    }
+
+   private:
+    const EVP_MD* m_md;
+    EVP_MD_CTX* m_ctx;
+};
+
+// MurmurHash3 x64_128（种子 0），输出 h1、h2 的小端字节，与参考实现一致
+class Murmur3Digest : public Digest
+{
+   public:
+    void update(const void* data, std::size_t size) override
+    {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        m_length += size;
+        if (m_tailSize > 0)
+        {
+            const auto count = std::min(size, blockSize - m_tailSize);
+            std::memcpy(m_tail + m_tailSize, bytes, count);
+            m_tailSize += count;
+            bytes += count;
+            size -= count;
+            if (m_tailSize < blockSize)
+            {
+                return;
+            }
+            block(m_tail);
+            m_tailSize = 0;
+        }
+        for (; size >= blockSize; bytes += blockSize, size -= blockSize)
+        {
+            block(bytes);
+        }
+        std::memcpy(m_tail, bytes, size);
+        m_tailSize = size;
+    }
+
+    std::string hexFinal() override
+    {
+        uint64_t k1 = 0;
+        uint64_t k2 = 0;
+        for (std::size_t i = m_tailSize; i > 8; --i)
+        {
+            k2 ^= static_cast<uint64_t>(m_tail[i - 1]) << (8 * (i - 9));
+        }
+        if (m_tailSize > 8)
+        {
+            m_h2 ^= rotl(k2 * c2, 33) * c1;
+        }
+        for (std::size_t i = std::min<std::size_t>(m_tailSize, 8); i > 0; --i)
+        {
+            k1 ^= static_cast<uint64_t>(m_tail[i - 1]) << (8 * (i - 1));
+        }
+        if (m_tailSize > 0)
+        {
+            m_h1 ^= rotl(k1 * c1, 31) * c2;
+        }
+
+        uint64_t h1 = m_h1 ^ m_length;
+        uint64_t h2 = m_h2 ^ m_length;
+        h1 += h2;
+        h2 += h1;
+        h1 = fmix(h1);
+        h2 = fmix(h2);
+        h1 += h2;
+        h2 += h1;
+
+        unsigned char out[16];
+        for (int i = 0; i < 8; ++i)
+        {
+            out[i] = static_cast<unsigned char>(h1 >> (8 * i));
+            out[8 + i] = static_cast<unsigned char>(h2 >> (8 * i));
+        }
+        m_h1 = m_h2 = m_length = 0;
+        m_tailSize = 0;
+
+        std::string hex(32, '\0');
+        hexEncode(out, sizeof(out), hex.data());
+        return hex;
+    }
+
+   private:
+    static constexpr std::size_t blockSize = 16;
+    static constexpr uint64_t c1 = 0x87c37b91114253d5ull;
+    static constexpr uint64_t c2 = 0x4cf5ad432745937full;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    static uint64_t fmix(uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ull;
+        k ^= k >> 33;
+        return k;
+    }
+
+    static uint64_t load64(const unsigned char* p)
+    {
+        uint64_t v = 0;
+        for (int i = 7; i >= 0; --i)
+        {
+            v = (v << 8) | p[i];
+        }
+        return v;
+    }
+
+    void block(const unsigned char* p)
+    {
+        m_h1 ^= rotl(load64(p) * c1, 31) * c2;
+        m_h1 = (rotl(m_h1, 27) + m_h2) * 5 + 0x52dce729;
+        m_h2 ^= rotl(load64(p + 8) * c2, 33) * c1;
+        m_h2 = (rotl(m_h2, 31) + m_h1) * 5 + 0x38495ab5;
+    }
+
+    uint64_t m_h1 = 0;
+    uint64_t m_h2 = 0;
+    uint64_t m_length = 0;
+    unsigned char m_tail[blockSize];
+    std::size_t m_tailSize = 0;
+};
+}  // namespace
+
+const std::vector<std::string>& Digest::algorithms()
+{
+    static const std::vector<std::string> names = {"md5", "sha256", "blake2b", "murmur3-128"};
+    return names;
+}
+
+bool Digest::isSupported(const std::string& algorithm)
+{
+    const auto& names = algorithms();
+    if (std::find(names.begin(), names.end(), algorithm) != names.end())
+    {
+        return true;
+    }
+    std::string leaf;
+    std::size_t chunkSize = 0;
+    return TreeDigest::parse(algorithm, leaf, chunkSize);
+}
+
+std::unique_ptr<Digest> Digest::create(const std::string& algorithm)
+{
+    if (algorithm == "md5")
+    {
+        return std::make_unique<EvpDigest>(EVP_md5());
+    }
+    if (algorithm == "sha256")
+    {
+        return std::make_unique<EvpDigest>(EVP_sha256());
+    }
+    if (algorithm == "blake2b")
+    {
+        return std::make_unique<EvpDigest>(EVP_blake2b512());
+    }
+    if (algorithm == "murmur3-128")
+    {
+        return std::make_unique<Murmur3Digest>();
+    }
+    std::string leaf;
+    std::size_t chunkSize = 0;
+    if (TreeDigest::parse(algorithm, leaf, chunkSize))
+    {
+        return std::make_unique<TreeDigest>(leaf, chunkSize);
+    }
+    throw std::invalid_argument("unsupported digest algorithm: " + algorithm);
+}
+
+TreeDigest::TreeDigest(const std::string& leaf, std::size_t chunkSize, unsigned threads)
+    : m_leaf(leaf), m_chunkSize(chunkSize), m_threadCount(threads)
+{
+    const auto& names = algorithms();
+    if (std::find(names.begin(), names.end(), leaf) == names.end() || chunkSize == 0)
+    {
+        throw std::invalid_argument("unsupported tree digest: " + name(leaf, chunkSize));
+    }
+    if (m_threadCount == 0)
+    {
+        const auto cores = std::max(1u, std::thread::hardware_concurrency());
+        m_threadCount = static_cast<unsigned>(
+            std::max<int64_t>(1, Config::instance().getInt("hash.threads", std::min(cores, 8u))));
+    }
+}
+
+TreeDigest::~TreeDigest()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_jobCv.notify_all();
+    for (auto& thread : m_workers)
+    {
+        thread.join();
+    }
+}
+
+std::string TreeDigest::name(const std::string& leaf, std::size_t chunkSize)
+{
+    return "tree-" + std::to_string(chunkSize >> 20) + "m-" + leaf;
+}
+
+bool TreeDigest::parse(const std::string& algorithm, std::string& leaf, std::size_t& chunkSize)
+{
+    static const std::string prefix = "tree-";
+    if (algorithm.compare(0, prefix.size(), prefix) != 0)
+    {
+        return false;
+    }
+    const auto pos = algorithm.find("m-", prefix.size());
+    if (pos == std::string::npos || pos == prefix.size() || pos - prefix.size() > 6)
+    {
+        return false;
+    }
+    std::size_t megabytes = 0;
+    for (auto i = prefix.size(); i < pos; ++i)
+    {
+        if (algorithm[i] < '0' || algorithm[i] > '9')
+        {
+            return false;
+        }
+        megabytes = megabytes * 10 + static_cast<std::size_t>(algorithm[i] - '0');
+    }
+    leaf = algorithm.substr(pos + 2);
+    chunkSize = megabytes << 20;
+    // 名称必须是规范形式，保证同一方案只有一种写法
+    const auto& names = algorithms();
+    return megabytes > 0 && std::find(names.begin(), names.end(), leaf) != names.end() &&
+           name(leaf, chunkSize) == algorithm;
+}
+
+void TreeDigest::update(const void* data, std::size_t size)
+{
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    while (size > 0)
+    {
+        if (m_current.capacity() < m_chunkSize)
+        {
+            m_current.reserve(m_chunkSize);
+        }
+        const auto count = std::min(size, m_chunkSize - m_current.size());
+        m_current.insert(m_current.end(), bytes, bytes + count);
+        bytes += count;
+        size -= count;
+        if (m_current.size() == m_chunkSize)
+        {
+            submit();
+        }
+    }
+}
+
+std::string TreeDigest::hexFinal()
+{
+    if (!m_current.empty() || m_chunks.empty())
+    {
+        submit();
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_doneCv.wait(lock, [this]() { return m_outstanding == 0; });
+
+    auto root = Digest::create(m_leaf);
+    for (const auto& chunk : m_chunks)
+    {
+        root->update(chunk.data(), chunk.size());
+    }
+    m_lastChunks.swap(m_chunks);
+    m_chunks.clear();
+    return root->hexFinal();
+}
+
+// 把当前块交给后台线程；在算的块已达到线程数时等待，限制内存占用
+void TreeDigest::submit()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_workers.empty())
+    {
+        for (unsigned i = 0; i < m_threadCount; ++i)
+        {
+            m_workers.emplace_back(&TreeDigest::worker, this);
+        }
+    }
+    m_doneCv.wait(lock, [this]() { return m_outstanding < m_threadCount; });
+    const auto index = m_chunks.size();
+    m_chunks.emplace_back();
+    ++m_outstanding;
+    m_jobs.push_back({index, std::move(m_current)});
+    if (m_freeBuffers.empty())
+    {
+        m_current = std::vector<unsigned char>();
+    }
+    else
+    {
+        m_current = std::move(m_freeBuffers.back());
+        m_freeBuffers.pop_back();
+    }
+    m_current.clear();
+    lock.unlock();
+    m_jobCv.notify_one();
+}
+
+void TreeDigest::worker()
+{
+    auto digest = Digest::create(m_leaf);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_jobCv.wait(lock, [this]() { return m_stop || !m_jobs.empty(); });
+        if (m_jobs.empty())
+        {
+            return;
+        }
+        auto job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        lock.unlock();
+
+        digest->update(job.data.data(), job.data.size());
+        auto hex = digest->hexFinal();
+
+        lock.lock();
+        m_chunks[job.index] = std::move(hex);
+        m_freeBuffers.push_back(std::move(job.data));
+        --m_outstanding;
+        m_doneCv.notify_all();
+    }
+}
+
+bool SampleDigest::ranges(uint64_t fileSize, std::size_t sampleSize, std::array<Range, 3>& out)
+{
+    if (sampleSize == 0 || fileSize < 3 * static_cast<uint64_t>(sampleSize))
+    {
+        return false;
+    }
+    out = {Range{0, sampleSize}, Range{(fileSize - sampleSize) / 2, sampleSize},
+           Range{fileSize - sampleSize, sampleSize}};
+    return true;
+}
+
+SampleDigest::SampleDigest(uint64_t fileSize, std::size_t sampleSize)
+    : m_fileSize(fileSize), m_digest(Digest::create("murmur3-128"))
+{
+    m_enabled = ranges(fileSize, sampleSize, m_ranges);
+}
+
+void SampleDigest::update(const void* data, std::size_t size)
+{
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    const auto begin = m_offset;
+    const auto end = m_offset + size;
+    m_offset = end;
+    if (!m_enabled)
+    {
+        return;
+    }
+    for (const auto& range : m_ranges)
+    {
+        const auto from = std::max(begin, range.offset);
+        const auto to = std::min(end, range.offset + range.size);
+        if (from < to)
+        {
+            m_digest->update(bytes + (from - begin), static_cast<std::size_t>(to - from));
+        }
+    }
+}
+
+void SampleDigest::skip(uint64_t size)
+{
+    m_offset += size;
+}
+
+std::string SampleDigest::hexFinal()
+{
+    auto hex = m_digest->hexFinal();
+    const bool complete = m_enabled && m_offset == m_fileSize;
+    m_offset = 0;
+    return complete ? hex : std::string();
+}
+
+void FileHasher::AlignedFree::operator()(unsigned char* p) const noexcept
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+FileHasher::Options FileHasher::configuredOptions()
+{
+    Options options;
+    const auto bufferKb = Config::instance().getInt("hash.buffer_kb", 1024);
+    options.bufferSize = static_cast<std::size_t>(std::max<int64_t>(bufferKb, 4)) * 1024;
+    options.useMmap = Config::instance().getBool("hash.mmap", false);
+    return options;
+}
+
+FileHasher& FileHasher::threadLocal()
+{
+    thread_local FileHasher hasher;
+    return hasher;
+}
+
+FileHasher::FileHasher(const Options& options) : m_options(options)
+{
+    // aligned_alloc 要求大小是对齐值的整数倍
+    m_options.bufferSize =
+        std::max(pageSize, (m_options.bufferSize + pageSize - 1) / pageSize * pageSize);
+    m_buffer.reset(alignedAlloc(m_options.bufferSize));
+}
+
+Digest& FileHasher::digest(const std::string& algorithm)
+{
+    auto it = m_digests.find(algorithm);
+    if (it == m_digests.end())
+    {
+        it = m_digests.emplace(algorithm, Digest::create(algorithm)).first;
+    }
+    return *it->second;
+}
+
+std::string FileHasher::hash(const std::string& filePath, const std::string& algorithm)
+{
+    return hash(filePath, digest(algorithm));
+}
+
+std::string FileHasher::hash(const std::string& filePath, Digest& d)
+{
+    bool ok = false;
+    bool mapped = false;
+    if (m_options.useMmap)
+    {
+        ok = hashMapped(filePath, d, mapped);
+    }
+    if (!mapped)
+    {
+        ok = hashRead(filePath, d);
+    }
+    // 出错时也要结束本次计算，下一个文件从头开始
+    auto hex = d.hexFinal();
+    return ok ? hex : std::string();
+}
+
+std::string FileHasher::sample(const std::string& filePath, uint64_t fileSize,
+                               std::size_t sampleSize)
+{
+    std::array<SampleDigest::Range, 3> ranges;
+    if (!SampleDigest::ranges(fileSize, sampleSize, ranges))
+    {
+        return {};
+    }
+    // 只读三段，段与段之间用 skip 跳过
+    SampleDigest digest(fileSize, sampleSize);
+#ifdef _WIN32
+    std::ifstream file(std::filesystem::u8path(filePath), std::ifstream::binary);
+    if (!file)
+    {
+        return {};
+    }
+#else
+    const int fd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return {};
+    }
+#endif
+    bool ok = true;
+    uint64_t position = 0;
+    for (const auto& range : ranges)
+    {
+        digest.skip(range.offset - position);
+        for (std::size_t done = 0; ok && done < range.size;)
+        {
+            const auto want = std::min(range.size - done, m_options.bufferSize);
+#ifdef _WIN32
+            file.seekg(static_cast<std::streamoff>(range.offset + done));
+            file.read(reinterpret_cast<char*>(m_buffer.get()), static_cast<std::streamsize>(want));
+            const auto count = static_cast<long long>(file.gcount());
+#else
+            const auto count =
+                ::pread(fd, m_buffer.get(), want, static_cast<off_t>(range.offset + done));
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+#endif
+            if (count <= 0)
+            {
+                ok = false;
+                break;
+            }
+            digest.update(m_buffer.get(), static_cast<std::size_t>(count));
+            done += static_cast<std::size_t>(count);
+        }
+        position = range.offset + range.size;
+    }
+#ifndef _WIN32
+    ::close(fd);
+#endif
+    digest.skip(fileSize - position);
+    auto hex = digest.hexFinal();
+    return ok ? hex : std::string();
+}
+
+bool FileHasher::hashRead(const std::string& filePath, Digest& digest)
+{
+#ifdef _WIN32
+    std::ifstream file(std::filesystem::u8path(filePath), std::ifstream::binary);
+    if (!file)
+    {
+        return false;
+    }
+    auto* buffer = reinterpret_cast<char*>(m_buffer.get());
+    while (file)
+    {
+        file.read(buffer, static_cast<std::streamsize>(m_options.bufferSize));
+        if (file.gcount() > 0)
+        {
+            digest.update(buffer, static_cast<std::size_t>(file.gcount()));
+        }
+    }
+    return !file.bad();
+#else
+    const int fd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    bool ok = true;
+    while (true)
+    {
+        const auto count = ::read(fd, m_buffer.get(), m_options.bufferSize);
+        if (count > 0)
+        {
+            digest.update(m_buffer.get(), static_cast<std::size_t>(count));
+        }
+        else if (count == 0)
+        {
+            break;
+        }
+        else if (errno != EINTR)
+        {
+            ok = false;
+            break;
+        }
+    }
+    ::close(fd);
+    return ok;
+#endif
+}
+
+bool FileHasher::hashMapped(const std::string& filePath, Digest& digest, bool& mapped)
+{
+    mapped = false;
+#ifdef _WIN32
+    (void)filePath;
+    (void)digest;
+    return false;
+#else
+    const int fd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    const auto size = static_cast<std::size_t>(st.st_size);
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    mapped = true;
+    ::madvise(data, size, MADV_SEQUENTIAL);
+    digest.update(data, size);
+    ::munmap(data, size);
+    return true;
+#endif
+}
@@ -1,9 +1,12 @@
 #include <charconv>
 #include <chrono>
+#include <cstdlib>
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <string_view>
 
+#include "bench.h"
 #include "service_run.h"
 #include "util.h"
 
@@ -14,8 +17,57 @@ int main(int argc, char* argv[])
     Utils::Log logger;
     try
     {
+        // 基准测试不需要数据库
+        if (argc >= 4 && std::string_view{argv[1]} == "bench")
+        {
+            std::string_view kind{argv[2]};
+            if (kind == "scan" && argc == 4)
+            {
+                return Bench::scan(argv[3]);
+            }
+            if (kind == "hash")
+            {
+                // 可选的第 4 个参数为最大文件大小（MB），默认测到 1GB
+                const uint64_t maxMb = argc >= 5 ? std::strtoull(argv[4], nullptr, 10) : 1024;
+                return Bench::hash(argv[3], maxMb << 20);
+            }
+            if (kind == "chunk")
+            {
+                // 可选的第 4 个参数为平均块大小（KB），默认取 store.chunk_avg_kb
+                const std::size_t avgKb = argc >= 5 ? std::strtoull(argv[4], nullptr, 10) : 0;
+                return Bench::chunk(argv[3], avgKb << 10);
+            }
+            if (kind == "delta")
+            {
+                // 可选的第 4 个参数为测试文件大小（MB），默认 256MB
+                const uint64_t sizeMb = argc >= 5 ? std::strtoull(argv[4], nullptr, 10) : 256;
+                return Bench::delta(argv[3], std::max<uint64_t>(sizeMb, 1) << 20);
+            }
+            if (kind == "copy")
+            {
+                // 可选的第 4 个参数为小文件个数，默认 5000
+                const std::size_t files = argc >= 5 ? std::strtoull(argv[4], nullptr, 10) : 5000;
+                return Bench::copy(argv[3], std::max<std::size_t>(files, 1));
+            }
+            logger.error("invalid args");
+            return 1;
+        }
+
+        // 按命令选择数据库性能参数
+        std::string_view firstArg = argc >= 2 ? argv[1] : "";
+        auto workload = ServiceRun::Workload::Backup;
+        if (firstArg == "checkdata" || firstArg == "checkdatawithhash")
+        {
+            workload = ServiceRun::Workload::Scrub;
+        }
+        else if (firstArg == "restore" || firstArg == "list" || firstArg == "add" ||
+                 firstArg == "rm" || firstArg == "checkschema")
+        {
+            workload = ServiceRun::Workload::Restore;
+        }
+
         ServiceRun serviceRun;
-        serviceRun.init();
+        serviceRun.init(workload);
         serviceRun.loadBackupRoot();
 
         if (argc >= 2)
@@ -32,6 +84,15 @@ int main(int argc, char* argv[])
                 logger.info("begin to checkdata with hash");
                 serviceRun.checkdata(true);
             }
+            else if (cmd == "checkschema")
+            {
+                return !serviceRun.checkQueryPlans();
+            }
+            else if (cmd == "reshard")
+            {
+                logger.info("begin to reshard backup targets");
+                return !serviceRun.reshardTargets();
+            }
             else if (cmd == "list")
             {
                 serviceRun.listBackupPaths();
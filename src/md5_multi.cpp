@@ -0,0 +1,358 @@
+#include "md5_multi.h"
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+#include "hasher.h"
+#include "md5_multi_kernel.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TM_MD5_MULTI_SSE2
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+namespace
+{
+constexpr unsigned maxLanes = 16;
+// 每路的读缓冲（64 的整数倍），另留两个块放末尾的填充
+constexpr std::size_t chunkSize = 64 * 1024;
+constexpr std::size_t bufferSize = chunkSize + 128;
+
+#ifdef TM_MD5_MULTI_SSE2
+// SSE2 是 x86-64 的基线指令集，无需运行时检测
+struct Sse2Ops
+{
+    using V = __m128i;
+    static constexpr unsigned lanes = 4;
+
+    static V load(const uint32_t* p) { return _mm_loadu_si128(reinterpret_cast<const V*>(p)); }
+    static void store(uint32_t* p, V v) { _mm_storeu_si128(reinterpret_cast<V*>(p), v); }
+    static V set1(uint32_t x) { return _mm_set1_epi32(static_cast<int>(x)); }
+    static V add(V a, V b) { return _mm_add_epi32(a, b); }
+    static V bitAnd(V a, V b) { return _mm_and_si128(a, b); }
+    static V bitOr(V a, V b) { return _mm_or_si128(a, b); }
+    static V bitXor(V a, V b) { return _mm_xor_si128(a, b); }
+    static V bitNot(V a) { return _mm_xor_si128(a, _mm_set1_epi32(-1)); }
+    template <int S>
+    static V rotl(V a)
+    {
+        return _mm_or_si128(_mm_slli_epi32(a, S), _mm_srli_epi32(a, 32 - S));
+    }
+};
+
+void blocksSse2(uint32_t* state, const unsigned char* const* data, std::size_t blocks)
+{
+    md5Blocks<Sse2Ops>(state, data, blocks);
+}
+#endif
+
+struct Kernel
+{
+    const char* name;
+    unsigned lanes;
+    Md5Multi::KernelFn blocks;
+};
+
+// AVX2 / AVX-512 内核只在 CMake 为其单独打开指令集（TM_MD5_MULTI_X86）时编译
+Kernel selectKernel()
+{
+#if defined(TM_MD5_MULTI_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return {"avx512", 16, Md5Multi::blocksAvx512};
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return {"avx2", 8, Md5Multi::blocksAvx2};
+    }
+#endif
+#ifdef TM_MD5_MULTI_SSE2
+    return {"sse2", 4, blocksSse2};
+#else
+    // 没有可用的向量指令时逐个文件交给 FileHasher（OpenSSL）
+    return {"scalar", 1, nullptr};
+#endif
+}
+
+const Kernel& kernel()
+{
+    static const Kernel selected = selectKernel();
+    return selected;
+}
+
+// 顺序读取一个文件；读满缓冲或到达末尾才返回
+class LaneFile
+{
+   public:
+    ~LaneFile() { close(); }
+
+    bool open(const std::string& path)
+    {
+        close();
+#ifdef _WIN32
+        m_stream.open(std::filesystem::u8path(path), std::ios::binary);
+        return m_stream.is_open();
+#else
+        m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (m_fd < 0)
+        {
+            return false;
+        }
+        ::posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        return true;
+#endif
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (m_stream.is_open())
+        {
+            m_stream.close();
+        }
+        m_stream.clear();
+#else
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+#endif
+    }
+
+    // 返回读取的字节数，出错返回 -1
+    long long read(unsigned char* buffer, std::size_t size)
+    {
+#ifdef _WIN32
+        m_stream.read(reinterpret_cast<char*>(buffer), static_cast<std::streamsize>(size));
+        if (m_stream.bad())
+        {
+            return -1;
+        }
+        return m_stream.gcount();
+#else
+        std::size_t total = 0;
+        while (total < size)
+        {
+            const auto n = ::read(m_fd, buffer + total, size - total);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return -1;
+            }
+            if (n == 0)
+            {
+                break;
+            }
+            total += static_cast<std::size_t>(n);
+        }
+        return static_cast<long long>(total);
+#endif
+    }
+
+   private:
+#ifdef _WIN32
+    std::ifstream m_stream;
+#else
+    int m_fd = -1;
+#endif
+};
+
+// 一路的状态：当前文件、已读长度以及缓冲中待处理的块
+struct Lane
+{
+    std::unique_ptr<unsigned char[]> buffer{new unsigned char[bufferSize]};
+    LaneFile file;
+    std::size_t index = 0;  // 当前文件在输入中的序号
+    bool active = false;
+    bool finalQueued = false;  // 缓冲中已包含末尾的填充块
+    uint64_t length = 0;
+    const unsigned char* next = nullptr;
+    std::size_t blocks = 0;
+};
+
+class MultiHasher
+{
+   public:
+    MultiHasher(const std::vector<std::string>& paths, const Kernel& kernel)
+        : m_paths(paths), m_kernel(kernel), m_results(paths.size()), m_lanes(kernel.lanes)
+    {
+    }
+
+    std::vector<std::string> run()
+    {
+        for (unsigned i = 0; i < m_kernel.lanes; ++i)
+        {
+            startNext(i);
+        }
+        std::array<const unsigned char*, maxLanes> data{};
+        while (true)
+        {
+            std::size_t blocks = 0;
+            for (unsigned i = 0; i < m_kernel.lanes; ++i)
+            {
+                auto& lane = m_lanes[i];
+                while (lane.active && lane.blocks == 0)
+                {
+                    refill(i);
+                }
+                if (lane.active && (blocks == 0 || lane.blocks < blocks))
+                {
+                    blocks = lane.blocks;
+                }
+            }
+            if (blocks == 0)
+            {
+                break;
+            }
+            // 各路同步前进 blocks 个块；空闲的路用自己的缓冲凑数，结果丢弃
+            for (unsigned i = 0; i < m_kernel.lanes; ++i)
+            {
+                auto& lane = m_lanes[i];
+                data[i] = lane.active ? lane.next : lane.buffer.get();
+            }
+            m_kernel.blocks(m_state.data(), data.data(), blocks);
+            for (auto& lane : m_lanes)
+            {
+                if (lane.active)
+                {
+                    lane.next += blocks * 64;
+                    lane.blocks -= blocks;
+                }
+            }
+        }
+        return std::move(m_results);
+    }
+
+   private:
+    uint32_t& word(unsigned lane, unsigned k) { return m_state[k * m_kernel.lanes + lane]; }
+
+    // 给第 i 路分配下一个文件；打不开的文件直接记为空结果
+    void startNext(unsigned i)
+    {
+        auto& lane = m_lanes[i];
+        lane.active = false;
+        while (m_next < m_paths.size())
+        {
+            const auto index = m_next++;
+            if (!lane.file.open(m_paths[index]))
+            {
+                continue;
+            }
+            lane.index = index;
+            lane.active = true;
+            lane.finalQueued = false;
+            lane.length = 0;
+            lane.blocks = 0;
+            word(i, 0) = 0x67452301;
+            word(i, 1) = 0xefcdab89;
+            word(i, 2) = 0x98badcfe;
+            word(i, 3) = 0x10325476;
+            return;
+        }
+        lane.file.close();
+    }
+
+    // 缓冲已处理完：输出结果并换下一个文件，或继续读取
+    void refill(unsigned i)
+    {
+        auto& lane = m_lanes[i];
+        if (lane.finalQueued)
+        {
+            unsigned char digest[16];
+            for (unsigned k = 0; k < 4; ++k)
+            {
+                const auto v = word(i, k);
+                digest[4 * k] = static_cast<unsigned char>(v);
+                digest[4 * k + 1] = static_cast<unsigned char>(v >> 8);
+                digest[4 * k + 2] = static_cast<unsigned char>(v >> 16);
+                digest[4 * k + 3] = static_cast<unsigned char>(v >> 24);
+            }
+            auto& hex = m_results[lane.index];
+            hex.assign(32, '\0');
+            hexEncode(digest, sizeof(digest), hex.data());
+            startNext(i);
+            return;
+        }
+
+        unsigned char* buffer = lane.buffer.get();
+        const auto n = lane.file.read(buffer, chunkSize);
+        if (n < 0)
+        {
+            startNext(i);
+            return;
+        }
+        const auto size = static_cast<std::size_t>(n);
+        lane.length += size;
+        lane.next = buffer;
+        lane.blocks = size / 64;
+        if (size == chunkSize)
+        {
+            return;
+        }
+
+        // 到达文件末尾：在剩余字节后原地追加 0x80、补零和位长度
+        const auto rest = size % 64;
+        unsigned char* tail = buffer + lane.blocks * 64;
+        const std::size_t tailBlocks = rest < 56 ? 1 : 2;
+        tail[rest] = 0x80;
+        std::fill(tail + rest + 1, tail + tailBlocks * 64 - 8, 0);
+        const uint64_t bits = lane.length * 8;
+        for (unsigned k = 0; k < 8; ++k)
+        {
+            tail[tailBlocks * 64 - 8 + k] = static_cast<unsigned char>(bits >> (8 * k));
+        }
+        lane.blocks += tailBlocks;
+        lane.finalQueued = true;
+        lane.file.close();
+    }
+
+    const std::vector<std::string>& m_paths;
+    const Kernel& m_kernel;
+    std::vector<std::string> m_results;
+    std::vector<Lane> m_lanes;
+    std::array<uint32_t, 4 * maxLanes> m_state{};
+    std::size_t m_next = 0;
+};
+}  // namespace
+
+const char* Md5Multi::kernelName()
+{
+    return kernel().name;
+}
+
+unsigned Md5Multi::lanes()
+{
+    return kernel().lanes;
+}
+
+std::vector<std::string> Md5Multi::hashFiles(const std::vector<std::string>& paths)
+{
+    // 只有一个文件或没有向量内核时没有可并行的路，逐个计算
+    if (paths.size() < 2 || kernel().blocks == nullptr)
+    {
+        std::vector<std::string> results;
+        results.reserve(paths.size());
+        auto& hasher = FileHasher::threadLocal();
+        for (const auto& path : paths)
+        {
+            results.push_back(hasher.md5(path));
+        }
+        return results;
+    }
+    return MultiHasher(paths, kernel()).run();
+}
@@ -0,0 +1,34 @@
+// AVX2 内核：8 路，本文件单独以 -mavx2 编译，仅在 CPU 支持时调用
+#include "md5_multi_kernel.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+
+namespace
+{
+struct Avx2Ops
+{
+    using V = __m256i;
+    static constexpr unsigned lanes = 8;
+
+    static V load(const uint32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const V*>(p)); }
+    static void store(uint32_t* p, V v) { _mm256_storeu_si256(reinterpret_cast<V*>(p), v); }
+    static V set1(uint32_t x) { return _mm256_set1_epi32(static_cast<int>(x)); }
+    static V add(V a, V b) { return _mm256_add_epi32(a, b); }
+    static V bitAnd(V a, V b) { return _mm256_and_si256(a, b); }
+    static V bitOr(V a, V b) { return _mm256_or_si256(a, b); }
+    static V bitXor(V a, V b) { return _mm256_xor_si256(a, b); }
+    static V bitNot(V a) { return _mm256_xor_si256(a, _mm256_set1_epi32(-1)); }
+    template <int S>
+    static V rotl(V a)
+    {
+        return _mm256_or_si256(_mm256_slli_epi32(a, S), _mm256_srli_epi32(a, 32 - S));
+    }
+};
+}  // namespace
+
+void Md5Multi::blocksAvx2(uint32_t* state, const unsigned char* const* data, std::size_t blocks)
+{
+    md5Blocks<Avx2Ops>(state, data, blocks);
+}
+#endif
@@ -0,0 +1,36 @@
+// AVX-512 内核：16 路，本文件单独以 -mavx512f 编译，仅在 CPU 支持时调用
+#include "md5_multi_kernel.h"
+
+#ifdef __AVX512F__
+#include <immintrin.h>
+
+namespace
+{
+struct Avx512Ops
+{
+    using V = __m512i;
+    static constexpr unsigned lanes = 16;
+
+    static V load(const uint32_t* p) { return _mm512_loadu_si512(p); }
+    static void store(uint32_t* p, V v) { _mm512_storeu_si512(p, v); }
+    static V set1(uint32_t x) { return _mm512_set1_epi32(static_cast<int>(x)); }
+    static V add(V a, V b) { return _mm512_add_epi32(a, b); }
+    static V bitAnd(V a, V b) { return _mm512_and_si512(a, b); }
+    static V bitOr(V a, V b) { return _mm512_or_si512(a, b); }
+    static V bitXor(V a, V b) { return _mm512_xor_si512(a, b); }
+    static V bitNot(V a) { return _mm512_xor_si512(a, _mm512_set1_epi32(-1)); }
+    template <int S>
+    static V rotl(V a)
+    {
+        // GCC 的 _mm512_rol_epi32（以及移位）以未初始化的向量作掩码源，-Wall -Wextra 下报
+        // maybe-uninitialized；全掩码的 maskz 形式以零向量作源，生成的仍是一条 vprold
+        return _mm512_maskz_rol_epi32(static_cast<__mmask16>(0xFFFF), a, S);
+    }
+};
+}  // namespace
+
+void Md5Multi::blocksAvx512(uint32_t* state, const unsigned char* const* data, std::size_t blocks)
+{
+    md5Blocks<Avx512Ops>(state, data, blocks);
+}
+#endif
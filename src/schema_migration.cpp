@@ -0,0 +1,250 @@
+#include "schema_migration.h"
+
+#include "catalog_queries.h"
+
+namespace
+{
+struct Migration
+{
+    int version;
+    const char* description;
+    std::vector<const char*> statements;
+};
+
+// 只能在末尾追加，已发布的迁移不可修改
+const std::vector<Migration>& migrations()
+{
+    static const std::vector<Migration> list = {
+        {1,
+         "indexes for catalog, history and restore lookups",
+         {
+             // 按来源取文件并按路径有序输出（归并扫描），同时覆盖 id
+             "create index if not exists idx_backfiles_root_path "
+             "on tb_backfiles(backuprootid, filepath)",
+             // 恢复时只按路径查找
+             "create index if not exists idx_backfiles_filepath on tb_backfiles(filepath)",
+             // 取最新版本 max(id)、统计版本数、按文件删除版本
+             "create index if not exists idx_backfilehistory_file "
+             "on tb_backfilehistory(backupfileid, id)",
+         }},
+        {2,
+         "normalize legacy doubled backslashes in tb_backfiles.filepath",
+         {
+             // 旧版本把路径中的每个反斜杠写成两个，这里还原为原始路径
+             "update tb_backfiles set filepath=replace(filepath,'\\\\','\\') "
+             "where instr(filepath,'\\\\')>0",
+             // 还原后同一来源下可能出现重复路径：版本并入 id 最小的记录，删除其余记录
+             "update tb_backfilehistory set backupfileid="
+             "(select min(d.id) from tb_backfiles f join tb_backfiles d "
+             "on d.backuprootid=f.backuprootid and d.filepath=f.filepath "
+             "where f.id=tb_backfilehistory.backupfileid) "
+             "where backupfileid in (select f.id from tb_backfiles f where exists "
+             "(select 1 from tb_backfiles d where d.backuprootid=f.backuprootid "
+             "and d.filepath=f.filepath and d.id<f.id))",
+             "delete from tb_backfiles where exists "
+             "(select 1 from tb_backfiles d where d.backuprootid=tb_backfiles.backuprootid "
+             "and d.filepath=tb_backfiles.filepath and d.id<tb_backfiles.id)",
+             "drop index if exists idx_backfiles_root_path",
+             "create unique index idx_backfiles_root_path on tb_backfiles(backuprootid, filepath)",
+         }},
+        {3,
+         "current version columns on tb_backfiles",
+         {
+             // 判断是否需要拷贝只看最新版本，冗余到文件表后比较时不必访问版本表；
+             // 与版本表在同一事务中维护，versionhistorycnt、lastbackuptime 也一并修正
+             "alter table tb_backfiles add column lasthistoryid INTEGER",
+             "alter table tb_backfiles add column lastmotifytime INTEGER",
+             "alter table tb_backfiles add column lastfilesize INTEGER",
+             "alter table tb_backfiles add column lastmd5 TEXT",
+             "update tb_backfiles set "
+             "(lasthistoryid,lastmotifytime,lastfilesize,lastmd5,lastbackuptime)="
+             "(select id,motifytime,filesize,md5,copyendtime from tb_backfilehistory "
+             "where backupfileid=tb_backfiles.id order by id desc limit 1),"
+             "versionhistorycnt=(select count(*) from tb_backfilehistory "
+             "where backupfileid=tb_backfiles.id)",
+         }},
+        {4,
+         "digest algorithm per history row",
+         {
+             // md5 列保存摘要值，hashalgo 记录算法；已有记录都是 MD5，带默认值添加列不会改写旧行
+             "alter table tb_backfilehistory add column hashalgo TEXT DEFAULT 'md5'",
+             "alter table tb_backfiles add column lasthashalgo TEXT DEFAULT 'md5'",
+         }},
+        {5,
+         "per-chunk digests of tree hashed versions",
+         {
+             // 只有 hashalgo 为 tree-* 的版本有记录，按 (historyid, chunkindex) 聚簇存放
+             "create table if not exists tb_backfilechunks ("
+             "historyid INTEGER NOT NULL, chunkindex INTEGER NOT NULL, digest TEXT NOT NULL, "
+             "primary key (historyid, chunkindex)) without rowid",
+         }},
+        {6,
+         "persistent digest cache of source files",
+         {
+             // 每个 inode 只保留最近一次计算的结果，cachedat 为写入时间（unix 秒），用于清理
+             "create table if not exists tb_hashcache ("
+             "device INTEGER NOT NULL, inode INTEGER NOT NULL, filesize INTEGER NOT NULL, "
+             "motifytime INTEGER NOT NULL, changetime INTEGER NOT NULL, hashalgo TEXT NOT NULL, "
+             "digest TEXT NOT NULL, cachedat INTEGER NOT NULL, "
+             "primary key (device, inode)) without rowid",
+             "create index if not exists idx_hashcache_cachedat on tb_hashcache (cachedat)",
+         }},
+        {7,
+         "sample digests for quick change detection",
+         {
+             // 旧版本没有抽样摘要（NULL），下次备份新版本后才能快速判断
+             "alter table tb_backfilehistory add column sampledigest TEXT",
+             "alter table tb_backfilehistory add column samplekb INTEGER DEFAULT 0",
+             "alter table tb_backfiles add column lastsampledigest TEXT",
+             "alter table tb_backfiles add column lastsamplekb INTEGER DEFAULT 0",
+         }},
+        {8,
+         "content addressed objects with reference counts",
+         {
+             // 每个备份文件（对象）一行，refcount 为引用它的版本数；
+             // 已有的版本按目标路径归并，同一路径被多个版本引用时计数随之累加
+             "create table if not exists tb_objects ("
+             "id INTEGER PRIMARY KEY, backuptargetrootid INTEGER NOT NULL, "
+             "backuptargetpath TEXT NOT NULL, filesize INTEGER NOT NULL, hashalgo TEXT NOT NULL, "
+             "digest TEXT NOT NULL, refcount INTEGER NOT NULL DEFAULT 0)",
+             "insert into tb_objects "
+             "(backuptargetrootid,backuptargetpath,filesize,hashalgo,digest,refcount) "
+             "select backuptargetrootid,backuptargetpath,max(filesize),max(coalesce(hashalgo,'md5')),"
+             "max(coalesce(md5,'')),count(*) from tb_backfilehistory "
+             "where backuptargetpath is not null group by backuptargetrootid,backuptargetpath",
+             "create unique index if not exists idx_objects_path "
+             "on tb_objects (backuptargetrootid, backuptargetpath)",
+             // 旧数据中可能已有内容相同的多个对象，内容索引不要求唯一
+             "create index if not exists idx_objects_content "
+             "on tb_objects (filesize, hashalgo, digest)",
+         }},
+        {9,
+         "chunk manifests of versions stored by content defined chunks",
+         {
+             // storage 为 chunks 的版本没有自己的备份文件，内容按顺序由各块对象拼接而成
+             "alter table tb_backfilehistory add column storage TEXT DEFAULT 'file'",
+             "create table if not exists tb_manifestchunks ("
+             "historyid INTEGER NOT NULL, chunkindex INTEGER NOT NULL, "
+             "objectid INTEGER NOT NULL, chunksize INTEGER NOT NULL, "
+             "primary key (historyid, chunkindex)) without rowid",
+         }},
+        {10,
+         "append-only versions referencing their predecessor",
+         {
+             // storage 为 append 的版本只有追加部分的备份文件，其余内容来自 basehistoryid
+             "alter table tb_backfilehistory add column basehistoryid INTEGER DEFAULT 0",
+             "alter table tb_backfilehistory add column chaindepth INTEGER DEFAULT 0",
+         }},
+        {11,
+         "rolling checksum signatures for delta versions",
+         {
+             // storage 为 delta 的版本的备份文件是相对 basehistoryid 的补丁；
+             // 签名按文件保存最新版本的，下一个版本据此编码，不必读取旧版本
+             "create table if not exists tb_signatures ("
+             "backupfileid INTEGER PRIMARY KEY, historyid INTEGER NOT NULL, "
+             "signature BLOB NOT NULL)",
+             "create index if not exists idx_signatures_historyid on tb_signatures (historyid)",
+         }},
+        {12,
+         "lookup of versions by backup file for moving objects",
+         {
+             // 迁移目录布局（reshard）时按原路径修改引用该对象的全部版本
+             "create index if not exists idx_backfilehistory_target "
+             "on tb_backfilehistory (backuptargetrootid, backuptargetpath)",
+         }},
+    };
+    return list;
+}
+}  // namespace
+
+int SchemaMigration::latestVersion() { return migrations().back().version; }
+
+int SchemaMigration::currentVersion()
+{
+    if (auto ret = m_sqliteHelper.query("pragma user_version"); ret && ret->executeStep())
+    {
+        return ret->getColumn(0).getInt();
+    }
+    throw SQLite::Exception("SchemaMigration: cannot read user_version");
+}
+
+void SchemaMigration::migrate()
+{
+    const int current = currentVersion();
+    if (current > latestVersion())
+    {
+        throw SQLite::Exception("SchemaMigration: database version " + std::to_string(current) +
+                                " is newer than this program (" +
+                                std::to_string(latestVersion()) + ")");
+    }
+    for (const auto& migration : migrations())
+    {
+        if (migration.version <= current)
+        {
+            continue;
+        }
+        m_sqliteHelper.beginTransaction();
+        try
+        {
+            for (const auto* sql : migration.statements)
+            {
+                m_sqliteHelper.execSql(sql);
+            }
+            // user_version 的修改随事务一起提交或回滚
+            m_sqliteHelper.execSql("pragma user_version = " +
+                                   std::to_string(migration.version));
+            m_sqliteHelper.commitTransaction();
+        }
+        catch (const std::exception& e)
+        {
+            m_sqliteHelper.rollbackTransaction();
+            throw SQLite::Exception("SchemaMigration: migration " +
+                                    std::to_string(migration.version) + " (" +
+                                    migration.description + ") failed: " + e.what());
+        }
+    }
+}
+
+std::vector<std::string> SchemaMigration::checkQueryPlans()
+{
+    static const std::vector<const std::string*> hotQueries = {
+        &CatalogQueries::latestVersionsByRoot, &CatalogQueries::fileIdsByRoot,
+        &CatalogQueries::historyByFile,        &CatalogQueries::refreshCurrentVersion,
+        &CatalogQueries::restoreVersions,      &CatalogQueries::chunkDigestsByHistory,
+        &CatalogQueries::deleteChunkDigests,   &CatalogQueries::cachedDigest,
+        &CatalogQueries::pruneDigestCache,     &CatalogQueries::objectSizeExists,
+        &CatalogQueries::findObject,           &CatalogQueries::releaseObject,
+        &CatalogQueries::objectByPath,         &CatalogQueries::manifestByHistory,
+        &CatalogQueries::deleteManifest,       &CatalogQueries::versionStorage,
+        &CatalogQueries::deltaBasis,           &CatalogQueries::deleteSignature,
+        &CatalogQueries::objectsByTarget,      &CatalogQueries::moveObjectVersions,
+    };
+
+    std::vector<std::string> problems;
+    for (const auto* sql : hotQueries)
+    {
+        auto plan = m_sqliteHelper.prepareQuery("explain query plan " + *sql);
+        if (!plan)
+        {
+            problems.push_back("cannot prepare: " + *sql);
+            continue;
+        }
+        // 全表扫描或为排序建临时 B 树都意味着开销随表大小增长
+        std::string details;
+        bool bad = false;
+        while (plan->executeStep())
+        {
+            const std::string detail = plan->getColumn("detail").getString();
+            details += "\n    " + detail;
+            if (detail.rfind("SCAN ", 0) == 0 || detail.find("TEMP B-TREE") != std::string::npos)
+            {
+                bad = true;
+            }
+        }
+        if (bad)
+        {
+            problems.push_back(*sql + details);
+        }
+    }
+    return problems;
+}
@@ -3,15 +3,32 @@
 #include <algorithm>
 #include <chrono>
 #include <ctime>
+#include <deque>
+#include <exception>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <optional>
+#include <set>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <tuple>
 #include <vector>
 
+#include "catalog_queries.h"
+#include "chunker.h"
+#include "config.h"
+#include "copy_engine.h"
+#include "delta.h"
+#include "file_scanner.h"
+#include "hasher.h"
+#include "md5_multi.h"
+#include "schema_migration.h"
+#include "uring_copy.h"
 #include "util.h"
 
 namespace
@@ -21,349 +38,1798 @@ inline std::filesystem::path u8path_from(const std::string& s)
 {
     return std::filesystem::u8path(s);
 }
+
+// 旧版本通过 file_clock 与 system_clock 的差值换算修改时间，结果可能偏差 1 毫秒
+// （整秒时间戳常被记成 xxx999），与扫描得到的精确值比较时容忍这一误差
+inline bool sameMotifyTime(int64_t indb, int64_t real)
+{
+    return indb - real <= 1 && real - indb <= 1;
+}
+
+// 扫描线程数（0 表示按核数）与扫描结果缓冲的条目数
+inline unsigned scanThreads()
+{
+    return static_cast<unsigned>(
+        std::clamp<int64_t>(Config::instance().getInt("scan.threads", 0), 0, 256));
+}
+
+inline std::size_t scanBuffer()
+{
+    return static_cast<std::size_t>(
+        std::max<int64_t>(1, Config::instance().getInt("scan.buffer", 65536)));
+}
+
+// 批量事务每批的最大行数与最长时间（毫秒），都至少为 1
+inline std::size_t batchRows()
+{
+    return static_cast<std::size_t>(
+        std::max<int64_t>(1, Config::instance().getInt("db.batch.rows", 1000)));
+}
+
+inline int64_t batchMillis()
+{
+    return std::max<int64_t>(1, Config::instance().getInt("db.batch.ms", 2000));
+}
+
+// 攒够这么多个待比较的文件再一起计算 MD5，每路平均分到几个文件
+inline std::size_t pendingCompareLimit()
+{
+    return static_cast<std::size_t>(Md5Multi::lanes()) * 4;
+}
+
+// 新版本使用的摘要算法（hash.algorithm），旧版本按各自记录的算法校验
+const std::string& hashAlgorithm()
+{
+    static const std::string algorithm = Config::instance().getString("hash.algorithm", "md5");
+    return algorithm;
+}
+
+// 不小于 hash.tree_min_mb 的文件使用分块树形摘要（0 表示不使用），块大小为 hash.tree_chunk_mb
+std::string hashAlgorithmFor(uint64_t fileSize)
+{
+    static const auto minBytes =
+        static_cast<uint64_t>(std::max<int64_t>(0, Config::instance().getInt("hash.tree_min_mb", 0)))
+        << 20;
+    static const auto chunkBytes =
+        static_cast<std::size_t>(
+            std::max<int64_t>(1, Config::instance().getInt("hash.tree_chunk_mb", 8)))
+        << 20;
+    if (minBytes == 0 || fileSize < minBytes)
+    {
+        return hashAlgorithm();
+    }
+    return TreeDigest::name(hashAlgorithm(), chunkBytes);
+}
+
+// 抽样摘要每段的大小（hash.sample_kb），0 表示不计算
+inline int64_t sampleKb()
+{
+    return std::max<int64_t>(0, Config::instance().getInt("hash.sample_kb", 64));
+}
+
+// 内容相同的版本共用一个备份文件（store.dedup）
+inline bool dedupEnabled()
+{
+    return Config::instance().getBool("store.dedup", true);
+}
+
+// 不小于 store.chunk_min_mb 的文件按内容分块保存（0 表示不分块）
+inline uint64_t chunkMinBytes()
+{
+    return static_cast<uint64_t>(
+               std::max<int64_t>(0, Config::instance().getInt("store.chunk_min_mb", 0)))
+           << 20;
+}
+
+// 只增长的文件只保存追加的部分（store.append）；原大小不足 store.append_min_mb 的文件直接备份，
+// 连续追加 store.append_max_chain 次后保存一次完整版本，限制恢复时需要拼接的部分
+inline bool appendEnabled()
+{
+    return Config::instance().getBool("store.append", true);
+}
+
+inline int64_t appendMinBytes()
+{
+    return std::max<int64_t>(0, Config::instance().getInt("store.append_min_mb", 1)) << 20;
+}
+
+inline int64_t appendMaxChain()
+{
+    return std::max<int64_t>(1, Config::instance().getInt("store.append_max_chain", 30));
+}
+
+// 来源在 store.delta_roots 中（以 ; 分隔，留空表示全部来源）、不小于 store.delta_min_mb
+// 的文件按差量保存（0 表示不使用）；签名块大小为 store.delta_block_kb，
+// 连续 store.delta_max_chain 个差量版本后保存一次完整版本，限制恢复时需要应用的补丁数
+inline uint64_t deltaMinBytes()
+{
+    return static_cast<uint64_t>(
+               std::max<int64_t>(0, Config::instance().getInt("store.delta_min_mb", 0)))
+           << 20;
+}
+
+bool deltaRoot(const std::string& rootpath)
+{
+    std::istringstream roots(Config::instance().getString("store.delta_roots", ""));
+    bool any = false;
+    for (std::string root; std::getline(roots, root, ';');)
+    {
+        if (root.empty())
+        {
+            continue;
+        }
+        any = true;
+        if (root == rootpath)
+        {
+            return true;
+        }
+    }
+    return !any;
+}
+
+inline bool deltaSize(uint64_t fileSize)
+{
+    return deltaMinBytes() != 0 && fileSize >= deltaMinBytes();
+}
+
+inline uint32_t deltaBlockSize()
+{
+    return static_cast<uint32_t>(
+               std::clamp<int64_t>(Config::instance().getInt("store.delta_block_kb", 64), 1, 65536))
+           << 10;
+}
+
+inline int64_t deltaMaxChain()
+{
+    return std::max<int64_t>(1, Config::instance().getInt("store.delta_max_chain", 8));
+}
+
+// 并行拷贝（copy.parallel）：每个目标同时拷贝 copy.per_target 个文件（机械硬盘宜为 1），
+// 共 copy.workers 个线程（0 表示目标数 × copy.per_target，最多 16）
+inline bool parallelCopy()
+{
+    return Config::instance().getBool("copy.parallel", true);
+}
+
+inline unsigned copyPerTarget()
+{
+    return static_cast<unsigned>(
+        std::clamp<int64_t>(Config::instance().getInt("copy.per_target", 1), 1, 64));
+}
+
+inline unsigned copyWorkers(std::size_t targets)
+{
+    const auto configured = Config::instance().getInt("copy.workers", 0);
+    if (configured > 0)
+    {
+        return static_cast<unsigned>(std::min<int64_t>(configured, 256));
+    }
+    return static_cast<unsigned>(
+        std::clamp<std::size_t>(targets * copyPerTarget(), 1, 16));
+}
+
+// io_uring 拷贝小文件（copy.uring，需并行拷贝）：不超过 copy.uring_max_kb 的文件
+// 每 copy.uring_batch 个一批交给一个工作线程，同时处理 copy.uring_depth 个文件。
+// openat/close 在内核中转交工作线程，文件在页缓存中时反而比同步拷贝慢，默认关闭，
+// 可用 bench copy 在实际的盘上比较后开启
+inline bool uringCopy()
+{
+    return Config::instance().getBool("copy.uring", false);
+}
+
+inline uint64_t uringMaxBytes()
+{
+    return static_cast<uint64_t>(
+               std::clamp<int64_t>(Config::instance().getInt("copy.uring_max_kb", 1024), 1,
+                                   1 << 20))
+           << 10;
+}
+
+inline std::size_t uringBatch()
+{
+    return static_cast<std::size_t>(
+        std::clamp<int64_t>(Config::instance().getInt("copy.uring_batch", 64), 1, 4096));
+}
+
+inline unsigned uringDepth()
+{
+    return static_cast<unsigned>(
+        std::clamp<int64_t>(Config::instance().getInt("copy.uring_depth", 32), 1, 4096));
+}
+
+// 备份文件的目录布局（store.layout）：sharded 按文件名（摘要）的前四个字符分两级子目录
+// （<目标目录>/ab/cd/<文件名>），每级最多 256 个，单个目录的条目数不随对象数增长；
+// flat 全部放在目标目录下（旧布局，reshard 命令可把已有对象迁移到分层布局）
+inline bool shardedLayout()
+{
+    return Config::instance().getString("store.layout", "sharded") != "flat";
+}
+
+// 对象相对目标根路径的位置，写入 backuptargetpath
+std::string objectPath(const std::string& rootDir, const std::string& name, bool sharded)
+{
+    if (!sharded || name.size() < 4)
+    {
+        return "/" + rootDir + "/" + name;
+    }
+    return "/" + rootDir + "/" + name.substr(0, 2) + "/" + name.substr(2, 2) + "/" + name;
+}
+
+// 把写好的临时文件改名为对象文件，所在的分层目录不存在时先创建。失败时抛出异常
+void placeObject(const std::string& tempFull, const std::string& targetFull)
+{
+    const auto target = u8path_from(targetFull);
+    std::filesystem::create_directories(target.parent_path());
+    std::filesystem::rename(u8path_from(tempFull), target);
+}
+
+// 写入一个块文件：先写临时文件再改名，不会留下不完整的块。失败时抛出异常
+void writeChunkFile(const std::string& path, const unsigned char* data, std::size_t size)
+{
+    const auto target = u8path_from(path);
+    std::filesystem::create_directories(target.parent_path());
+    auto temp = target;
+    temp += ".part";
+    std::ofstream out(temp, std::ofstream::binary | std::ofstream::trunc);
+    if (!out)
+    {
+        throw std::runtime_error("cannot create chunk file: " + temp.u8string());
+    }
+    out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+    out.close();
+    if (!out)
+    {
+        std::error_code ec;
+        std::filesystem::remove(temp, ec);
+        throw std::runtime_error("failed to write chunk file: " + temp.u8string());
+    }
+    std::filesystem::rename(temp, target);
+}
+
+// 源文件摘要缓存（hash.cache），超过 hash.cache_days 天未更新的记录在备份结束时清理
+inline bool digestCacheEnabled()
+{
+    return Config::instance().getBool("hash.cache", true);
+}
+
+inline int64_t digestCacheDays()
+{
+    return std::max<int64_t>(1, Config::instance().getInt("hash.cache_days", 30));
+}
+
+// 数据库参数依次取 db.<workload>.<key>、db.<key>，都未配置时使用该 workload 的默认值
+std::string profileString(const std::string& workload, const std::string& key,
+                          const std::string& def)
+{
+    const auto& config = Config::instance();
+    return config.getString("db." + workload + "." + key, config.getString("db." + key, def));
+}
+
+int64_t profileInt(const std::string& workload, const std::string& key, int64_t def)
+{
+    const auto& config = Config::instance();
+    return config.getInt("db." + workload + "." + key, config.getInt("db." + key, def));
+}
+
+SQLiteProfile sqliteProfile(ServiceRun::Workload workload)
+{
+    // 备份：大量小写事务，后台 checkpoint 避免提交时写回；
+    // 校验：顺序读完整个版本表，mmap 尽量覆盖数据库文件；
+    // 恢复等短命令：只读少量页，保持默认的小缓存
+    struct Defaults
+    {
+        const char* name;
+        int64_t cacheMb;
+        int64_t mmapMb;
+        const char* tempStore;
+        int64_t checkpointMs;
+    };
+    Defaults defaults{"backup", 64, 256, "memory", 1000};
+    if (workload == ServiceRun::Workload::Scrub)
+    {
+        defaults = {"scrub", 32, 1024, "memory", 1000};
+    }
+    else if (workload == ServiceRun::Workload::Restore)
+    {
+        defaults = {"restore", 2, 64, "default", 0};
+    }
+
+    const std::string name = defaults.name;
+    SQLiteProfile profile;
+    profile.name = name;
+    profile.journalMode = profileString(name, "journal_mode", "wal");
+    profile.synchronous = profileString(name, "synchronous", "normal");
+    profile.cacheSizeKb = profileInt(name, "cache_mb", defaults.cacheMb) * 1024;
+    profile.mmapSize = profileInt(name, "mmap_mb", defaults.mmapMb) * 1024 * 1024;
+    profile.tempStore = profileString(name, "temp_store", defaults.tempStore);
+    profile.busyTimeoutMs = profileInt(name, "busy_timeout_ms", 5000);
+    profile.checkpointMillis = profileInt(name, "checkpoint_ms", defaults.checkpointMs);
+    return profile;
+}
 }  // namespace
 
-void ServiceRun::init()
+void ServiceRun::init(Workload workload)
+{
+    logger.info("init db...");
+    if (!m_sqliteHelper.valid())
+    {
+        logger.error("SQLite init failed");
+        return;
+    }
+    logger.info("sqlite profile " + m_sqliteHelper.applyProfile(sqliteProfile(workload)));
+    // hash.algorithm 只能是基本算法，树形摘要由 hash.tree_min_mb 开启
+    const auto& algorithms = Digest::algorithms();
+    if (std::find(algorithms.begin(), algorithms.end(), hashAlgorithm()) == algorithms.end())
+    {
+        throw std::invalid_argument("unsupported hash.algorithm: " + hashAlgorithm());
+    }
+
+    SchemaMigration migration(m_sqliteHelper);
+    const int version = migration.currentVersion();
+    if (version < SchemaMigration::latestVersion())
+    {
+        logger.info("upgrading db schema: " + std::to_string(version) + " -> " +
+                    std::to_string(SchemaMigration::latestVersion()));
+    }
+    migration.migrate();
+    checkQueryPlans();
+}
+
+bool ServiceRun::checkQueryPlans()
+{
+    const auto problems = SchemaMigration(m_sqliteHelper).checkQueryPlans();
+    for (const auto& problem : problems)
+    {
+        logger.error("query does not use an index: " + problem);
+    }
+    return problems.empty();
+}
+
+void ServiceRun::loadBackupRoot()
+{
+    logger.info("loadBackupRoot");
+    if (auto res = m_sqliteHelper.prepareQuery("select * from tb_backuproot"); res)
+    {
+        while (res->executeStep())
+        {
+            timemachine::Backuproot backuproot;
+            backuproot.id = res->getColumn("id").getInt();
+            backuproot.rootpath = res->getColumn("rootpath").getString();
+            if (!std::filesystem::exists(u8path_from(backuproot.rootpath)))
+            {
+                logger.error("No found backup source: " + backuproot.rootpath);
+            }
+            else
+            {
+                m_backupRootList.emplace_back(std::move(backuproot));
+            }
+        }
+    }
+
+    if (auto res = m_sqliteHelper.prepareQuery("select * from tb_backuptargetroot"); res)
+    {
+        while (res->executeStep())
+        {
+            timemachine::Backuptargetroot backuptargetroot;
+            backuptargetroot.id = res->getColumn("id").getInt();
+            backuptargetroot.targetrootpath =
+                res->getColumn("targetrootpath").getString();
+            backuptargetroot.targetrootdir = targetBkDirName;
+
+            auto u8path = u8path_from(backuptargetroot.targetrootpath);
+            if (!std::filesystem::exists(u8path))
+            {
+                std::filesystem::create_directory(u8path);
+            }
+            if (!std::filesystem::exists(u8path))
+            {
+                logger.error("No found backup target: " +
+                             backuptargetroot.targetrootpath);
+            }
+            else
+            {
+                try
+                {
+                    backuptargetroot.spaceRemain =
+                        std::filesystem::space(u8path).available;
+                }
+                catch (const std::exception& e)
+                {
+                    logger.error(std::string("space() failed for: ") +
+                                 backuptargetroot.targetrootpath + " -> " + e.what());
+                    backuptargetroot.spaceRemain = 0;
+                }
+                m_backupTargetRootList.emplace_back(std::move(backuptargetroot));
+            }
+        }
+    }
+}
+
+std::optional<timemachine::Backuptargetroot> ServiceRun::getAvailableTarget(
+    uintmax_t needspace)
+{
+    std::vector<timemachine::Backuptargetroot> available;
+    available.reserve(m_backupTargetRootList.size());
+    for (auto& br : m_backupTargetRootList)
+    {
+        try
+        {
+            br.spaceRemain =
+                std::filesystem::space(u8path_from(br.targetrootpath)).available;
+        }
+        catch (const std::exception& e)
+        {
+            logger.error(std::string("failed to query space for ") + br.targetrootpath +
+                         " -> " + e.what());
+            br.spaceRemain = 0;
+        }
+        // 已排队但尚未写完的数据也要占用空间
+        br.spaceRemain -= std::min<uintmax_t>(br.spaceRemain, pendingCopyBytes(br.id));
+
+        if (br.spaceRemain > needspace)
+        {
+            available.emplace_back(br);
+        }
+    }
+
+    if (available.empty())
+    {
+        return std::nullopt;
+    }
+    // 并行拷贝时优先选排队数据最少的目标，各目标盘同时工作；否则选剩余空间最大的
+    if (m_copyScheduler)
+    {
+        return *std::min_element(available.begin(), available.end(),
+                                 [this](const auto& a, const auto& b)
+                                 {
+                                     const auto pa = pendingCopyBytes(a.id);
+                                     const auto pb = pendingCopyBytes(b.id);
+                                     return pa != pb ? pa < pb : a.spaceRemain > b.spaceRemain;
+                                 });
+    }
+    return *std::max_element(available.begin(), available.end(),
+                             [](const auto& a, const auto& b)
+                             { return a.spaceRemain < b.spaceRemain; });
+}
+
+std::string ServiceRun::copyFile(const std::string& source, const std::string& dest,
+                                 Digest& digest, Digest* sample)
+{
+    try
+    {
+        const auto destPath = u8path_from(dest);
+        const auto destDir = destPath.parent_path();
+        if (!std::filesystem::exists(destDir))
+        {
+            std::filesystem::create_directories(destDir);
+        }
+        auto hex = CopyEngine::instance().copy(source, dest, digest, sample);
+        // 与 std::filesystem::copy_file 一样保留源文件权限，失败不影响备份
+        std::error_code ec;
+        const auto perms = std::filesystem::status(u8path_from(source), ec).permissions();
+        if (!ec)
+        {
+            std::filesystem::permissions(destPath, perms, ec);
+        }
+        return hex;
+    }
+    catch (const std::exception& e)
+    {
+        logger.error(e.what());
+        throw;  // 保留原始异常信息，避免切片
+    }
+}
+
+bool ServiceRun::exeCopy(const timemachine::FileRecord& file, int64_t backupfileid)
+{
+    const auto& fileName = file.path;
+    const auto fileSize = static_cast<uintmax_t>(file.filesize);
+    const auto lastWriteTime = file.motifytime;
+
+    const auto algorithm = hashAlgorithmFor(fileSize);
+    auto digest = Digest::create(algorithm);
+    timemachine::BackupHistory history;
+    history.backupfileid = backupfileid;
+    history.filesize = file.filesize;
+    history.motifytime = lastWriteTime;
+    history.hashalgo = algorithm;
+    history.copystarttime = Utils::Date::getCurrentDateTime();
+
+    // 已有同样大小的对象（或正在拷贝同样大小的文件）时先计算摘要，内容相同则直接引用
+    // 已有的备份文件，不再拷贝；大小没有重复的文件（大多数）仍然拷贝时一并计算，只读一遍
+    const SizeKey key{file.filesize, algorithm};
+    bool sizeSeen = false;
+    bool inflight = false;
+    if (dedupEnabled())
+    {
+        inflight = m_inflightCopies.count(key) != 0;
+        if (auto ret = m_sqliteHelper.query(CatalogQueries::objectSizeExists, file.filesize,
+                                            algorithm);
+            ret)
+        {
+            sizeSeen = ret->executeStep();
+        }
+    }
+    if (sizeSeen || inflight)
+    {
+        history.md5 = FileHasher::threadLocal().hash(fileName, *digest);
+        const auto object =
+            history.md5.empty() || !sizeSeen
+                ? std::nullopt
+                : findObject(file.filesize, algorithm, history.md5);
+        if (object)
+        {
+            referenceObject(file, history, *digest, *object);
+            return true;
+        }
+        if (inflight && !history.md5.empty())
+        {
+            m_dedupWaiters[key].push_back({file, std::move(history), std::move(digest), m_copySeq});
+            return true;
+        }
+    }
+    return storeNewFile(file, history, *digest);
+}
+
+void ServiceRun::referenceObject(const timemachine::FileRecord& file,
+                                 timemachine::BackupHistory& history, const Digest& digest,
+                                 const StoredObject& object)
+{
+    history.sampledigest = FileHasher::threadLocal().sample(
+        file.path, static_cast<uintmax_t>(file.filesize),
+        static_cast<std::size_t>(sampleKb()) * 1024);
+    history.samplekb = history.sampledigest.empty() ? 0 : sampleKb();
+    history.backuptargetrootid = object.backuptargetrootid;
+    history.backuptargetpath = object.backuptargetpath;
+    history.copyendtime = Utils::Date::getCurrentDateTime();
+    m_sqliteHelper.exec(CatalogQueries::addObjectRef, object.id);
+    insertVersion(history, digest);
+    ++m_dedupCount;
+    m_dedupBytes += file.filesize;
+    logger.info("dedup file " + file.path + " -> " + object.backuptargetpath);
+}
+
+bool ServiceRun::storeNewFile(const timemachine::FileRecord& file,
+                              timemachine::BackupHistory& history, Digest& digest)
+{
+    const auto fileSize = static_cast<uintmax_t>(file.filesize);
+    // history 稍后移入拷贝任务，算法名先复制一份
+    const auto algorithm = history.hashalgo;
+    const auto backuptargetroot = getAvailableTarget(fileSize);
+    if (!backuptargetroot)
+    {
+        logger.error("no space in all targetbackups! need:" + std::to_string(fileSize));
+        return false;
+    }
+    if (m_deltaRoot && deltaSize(fileSize))
+    {
+        return storeDelta(file, *backuptargetroot, history, digest);
+    }
+    if (chunkMinBytes() != 0 && fileSize >= chunkMinBytes())
+    {
+        return storeChunked(file, *backuptargetroot, history, digest);
+    }
+
+    auto job = std::make_shared<CopyJob>();
+    job->file = file;
+    job->history = std::move(history);
+    job->target = *backuptargetroot;
+    job->timestamp = uniqueTimestamp();
+    job->digest = Digest::create(algorithm);
+    if (!m_copyScheduler)
+    {
+        runCopyJob(*job);
+        return finishCopyJob(*job);
+    }
+    // 拷贝完成前同样大小的新文件等待其结果去重
+    job->seq = ++m_copySeq;
+    m_inflightCopies[SizeKey{file.filesize, algorithm}].insert(job->seq);
+    if (m_uringCopy && fileSize <= uringMaxBytes())
+    {
+        const auto targetId = backuptargetroot->id;
+        auto& batch = m_copyBatches[targetId];
+        batch.push_back(std::move(job));
+        m_copyBatchBytes[targetId] += fileSize;
+        if (batch.size() >= uringBatch())
+        {
+            submitCopyBatch(targetId);
+        }
+        return true;
+    }
+    // 拷贝在目标的队列中进行，完成后在本线程写入目录
+    m_copyScheduler->submit(
+        backuptargetroot->id, fileSize, [job]() { runCopyJob(*job); },
+        [this, job]() { copyDone(*job); });
+    return true;
+}
+
+void ServiceRun::runCopyJob(CopyJob& job)
+{
+    // 使用 filesystem::path 构造目标路径更稳健
+    const auto targetPath = u8path_from(job.target.targetrootpath) / job.target.targetrootdir;
+
+    // 拷贝时同时计算摘要，源文件只读一遍；目标文件名包含摘要，
+    // 因此先写到临时文件，拷贝完成后再改成最终名称
+    const auto tempFull = (targetPath / ("_" + job.timestamp + ".part")).u8string();
+    SampleDigest sample(static_cast<uint64_t>(job.file.filesize),
+                        static_cast<std::size_t>(sampleKb()) * 1024);
+    try
+    {
+        job.history.md5 = copyFile(job.file.path, tempFull, *job.digest, &sample);
+        job.history.sampledigest = sample.hexFinal();
+    }
+    catch (const std::exception&)
+    {
+        job.error = "failed to copy file from " + job.file.path + " to " + tempFull;
+        std::error_code ec;
+        std::filesystem::remove(u8path_from(tempFull), ec);
+        return;
+    }
+    commitCopyJob(job, tempFull);
+}
+
+void ServiceRun::commitCopyJob(CopyJob& job, const std::string& tempFull)
+{
+    const auto relative = objectPath(job.target.targetrootdir,
+                                     job.history.md5 + "_" + job.timestamp, shardedLayout());
+    const auto targetFull = u8path_from(job.target.targetrootpath + relative).u8string();
+    try
+    {
+        placeObject(tempFull, targetFull);
+    }
+    catch (const std::exception& e)
+    {
+        job.error = e.what();
+        std::error_code ec;
+        std::filesystem::remove(u8path_from(tempFull), ec);
+        return;
+    }
+    job.targetFull = targetFull;
+    job.history.backuptargetpath = relative;
+}
+
+void ServiceRun::runCopyBatch(CopyBatch& jobs)
+{
+    if (jobs.empty())
+    {
+        return;
+    }
+    // 每个工作线程一个 io_uring；创建或提交失败后该线程不再使用
+    thread_local std::unique_ptr<UringCopier> copier;
+    thread_local bool unusable = false;
+    if (!copier && !unusable)
+    {
+        try
+        {
+            copier = std::make_unique<UringCopier>(uringDepth());
+        }
+        catch (const std::exception&)
+        {
+            unusable = true;
+        }
+    }
+    if (!copier)
+    {
+        for (auto& job : jobs)
+        {
+            runCopyJob(*job);
+        }
+        return;
+    }
+
+    // 同一批文件都在同一个目标上，openat 不会创建目录
+    const auto targetPath =
+        u8path_from(jobs.front()->target.targetrootpath) / jobs.front()->target.targetrootdir;
+    std::error_code ec;
+    std::filesystem::create_directories(targetPath, ec);
+    std::vector<UringCopier::Item> items;
+    std::deque<SampleDigest> samples;
+    items.reserve(jobs.size());
+    for (const auto& job : jobs)
+    {
+        samples.emplace_back(static_cast<uint64_t>(job->file.filesize),
+                             static_cast<std::size_t>(sampleKb()) * 1024);
+        UringCopier::Item item;
+        item.source = job->file.path;
+        item.dest = (targetPath / ("_" + job->timestamp + ".part")).u8string();
+        item.digest = job->digest.get();
+        item.sample = &samples.back();
+        items.push_back(std::move(item));
+    }
+    try
+    {
+        copier->copy(items);
+    }
+    catch (const std::exception&)
+    {
+        // 环已不可用：丢弃算了一半的摘要，整批改为逐个拷贝
+        copier.reset();
+        unusable = true;
+        for (std::size_t i = 0; i < jobs.size(); ++i)
+        {
+            jobs[i]->digest->hexFinal();
+            std::filesystem::remove(u8path_from(items[i].dest), ec);
+            runCopyJob(*jobs[i]);
+        }
+        return;
+    }
+    for (std::size_t i = 0; i < jobs.size(); ++i)
+    {
+        auto& job = *jobs[i];
+        if (!items[i].error.empty())
+        {
+            job.error = "failed to copy file from " + job.file.path + " to " + items[i].dest +
+                        ": " + items[i].error;
+            std::filesystem::remove(u8path_from(items[i].dest), ec);
+            continue;
+        }
+        job.history.md5 = items[i].hex;
+        job.history.sampledigest = samples[i].hexFinal();
+        job.uring = true;
+        commitCopyJob(job, items[i].dest);
+    }
+}
+
+void ServiceRun::submitCopyBatch(int targetId)
+{
+    const auto it = m_copyBatches.find(targetId);
+    if (it == m_copyBatches.end())
+    {
+        return;
+    }
+    auto batch = std::make_shared<CopyBatch>(std::move(it->second));
+    m_copyBatches.erase(it);
+    const auto bytes = m_copyBatchBytes[targetId];
+    m_copyBatchBytes.erase(targetId);
+    m_copyScheduler->submit(
+        targetId, bytes, [batch]() { runCopyBatch(*batch); },
+        [this, batch]()
+        {
+            for (auto& job : *batch)
+            {
+                copyDone(*job);
+            }
+        });
+}
+
+void ServiceRun::copyDone(CopyJob& job)
+{
+    if (!finishCopyJob(job))
+    {
+        m_copyFailed = true;
+    }
+    else if (job.uring)
+    {
+        ++m_uringCopyCount;
+    }
+    settleDedupWaiters(job);
+}
+
+void ServiceRun::settleDedupWaiters(const CopyJob& job)
+{
+    const SizeKey key{job.file.filesize, job.history.hashalgo};
+    uint64_t oldest = UINT64_MAX;  // 仍在拷贝的同样大小的文件中最早提交的
+    if (const auto it = m_inflightCopies.find(key); it != m_inflightCopies.end())
+    {
+        it->second.erase(job.seq);
+        if (it->second.empty())
+        {
+            m_inflightCopies.erase(it);
+        }
+        else
+        {
+            oldest = *it->second.begin();
+        }
+    }
+    const auto it = m_dedupWaiters.find(key);
+    if (it == m_dedupWaiters.end())
+    {
+        return;
+    }
+    auto waiters = std::move(it->second);
+    m_dedupWaiters.erase(it);
+    std::vector<DedupWaiter> remaining;
+    for (auto& waiter : waiters)
+    {
+        if (job.error.empty() && waiter.history.md5 == job.history.md5)
+        {
+            if (const auto object = findObject(job.file.filesize, job.history.hashalgo,
+                                               job.history.md5))
+            {
+                referenceObject(waiter.file, waiter.history, *waiter.digest, *object);
+                continue;
+            }
+        }
+        if (oldest > waiter.lastSeq)
+        {
+            // 开始等待时已在拷贝的同样大小的文件都已完成，内容都不相同
+            waiter.history.copystarttime = Utils::Date::getCurrentDateTime();
+            if (!storeNewFile(waiter.file, waiter.history, *waiter.digest))
+            {
+                m_copyFailed = true;
+            }
+            continue;
+        }
+        remaining.push_back(std::move(waiter));
+    }
+    if (!remaining.empty())
+    {
+        auto& list = m_dedupWaiters[key];
+        list.insert(list.begin(), std::make_move_iterator(remaining.begin()),
+                    std::make_move_iterator(remaining.end()));
+    }
+}
+
+uint64_t ServiceRun::pendingCopyBytes(int targetId) const
+{
+    const auto it = m_copyBatchBytes.find(targetId);
+    return (m_copyScheduler ? m_copyScheduler->pendingBytes(targetId) : 0) +
+           (it == m_copyBatchBytes.end() ? 0 : it->second);
+}
+
+bool ServiceRun::finishCopyJob(CopyJob& job)
+{
+    if (!job.error.empty())
+    {
+        logger.error(job.error);
+        return false;
+    }
+    m_unsyncedFiles.push_back(job.targetFull);
+
+    auto& history = job.history;
+    history.copyendtime = Utils::Date::getCurrentDateTime();
+    history.samplekb = history.sampledigest.empty() ? 0 : sampleKb();
+    history.backuptargetrootid = job.target.id;
+    m_sqliteHelper.exec(CatalogQueries::insertObject, history.backuptargetrootid,
+                        history.backuptargetpath, job.file.filesize, history.hashalgo,
+                        history.md5);
+    insertVersion(history, *job.digest);
+    ++m_fileCopyCount;
+    m_dataCopyCount += job.file.filesize;
+
+    logger.info("copy file from " + job.file.path + " to " + job.targetFull);
+    return true;
+}
+
+bool ServiceRun::drainCopies(bool wait)
+{
+    if (m_copyScheduler)
+    {
+        // 等待全部完成前先提交攒着的小文件批次；去重落空的文件在 drain 中才开始拷贝，
+        // 可能又攒成新的批次
+        do
+        {
+            while (wait && !m_copyBatches.empty())
+            {
+                submitCopyBatch(m_copyBatches.begin()->first);
+            }
+            m_copyScheduler->drain(wait);
+        } while (wait && !m_copyBatches.empty());
+    }
+    return !m_copyFailed;
+}
+
+std::string ServiceRun::uniqueTimestamp()
+{
+    m_lastTimestamp = std::max<int64_t>(Utils::getMilliTimeStamp(), m_lastTimestamp + 1);
+    return std::to_string(m_lastTimestamp);
+}
+
+int64_t ServiceRun::insertVersion(const timemachine::BackupHistory& history,
+                                  const Digest& digest)
+{
+    m_sqliteHelper.exec(
+        "insert into tb_backfilehistory "
+        "(backupfileid,backupid,motifytime,filesize,copystarttime,copyendtime,"
+        "backuptargetpath,backuptargetrootid,md5,hashalgo,sampledigest,samplekb,storage,"
+        "basehistoryid,chaindepth) "
+        "values (?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)",
+        history.backupfileid, m_backupId, history.motifytime, history.filesize,
+        history.copystarttime, history.copyendtime, history.backuptargetpath,
+        history.backuptargetrootid, history.md5, history.hashalgo, history.sampledigest,
+        history.samplekb, history.storage, history.basehistoryid, history.chaindepth);
+    const auto historyid = m_sqliteHelper.lastInsertRowid();
+    // 树形摘要的各块摘要一并保存，校验时可以定位到具体的块
+    if (const auto* tree = dynamic_cast<const TreeDigest*>(&digest))
+    {
+        const auto& chunks = tree->chunkDigests();
+        for (std::size_t i = 0; i < chunks.size(); ++i)
+        {
+            m_sqliteHelper.exec(CatalogQueries::insertChunkDigest, historyid,
+                                static_cast<int64_t>(i), chunks[i]);
+        }
+    }
+    // 与版本记录在同一事务中更新文件表上的最新版本信息
+    m_sqliteHelper.exec(CatalogQueries::setCurrentVersion, historyid, history.motifytime,
+                        history.filesize, history.md5, history.hashalgo, history.sampledigest,
+                        history.samplekb, history.copyendtime, history.backupfileid);
+    return historyid;
+}
+
+bool ServiceRun::storeChunked(const timemachine::FileRecord& file,
+                              const timemachine::Backuptargetroot& target,
+                              timemachine::BackupHistory& history, Digest& digest)
+{
+    // 块按基本算法寻址，与整个文件的对象同在 tb_objects 中，内容相同时也可以互相引用
+    const auto& chunkAlgorithm = hashAlgorithm();
+    const auto chunkDigest = Digest::create(chunkAlgorithm);
+    SampleDigest sample(static_cast<uint64_t>(file.filesize),
+                        static_cast<std::size_t>(sampleKb()) * 1024);
+    const auto chunkRoot =
+        std::string("/") + target.targetrootdir + "/" + std::string(chunkDirName) + "/";
+    struct ChunkRef
+    {
+        int64_t objectid = 0;  // 0 表示本次新写入的块
+        std::string path;
+        int64_t size = 0;
+        std::string digest;
+    };
+    std::vector<ChunkRef> manifest;
+    std::set<std::string> written;  // 本次写入的块文件，失败时删除
+    int64_t storedBytes = 0;
+
+    // 先读完整个文件、写好新块，再修改对象引用，读取失败时数据库中不留下多余的引用
+    try
+    {
+        Chunker::configured().split(
+            file.path,
+            [&](const unsigned char* data, std::size_t size)
+            {
+                digest.update(data, size);
+                sample.update(data, size);
+                chunkDigest->update(data, size);
+                ChunkRef chunk;
+                chunk.size = static_cast<int64_t>(size);
+                chunk.digest = chunkDigest->hexFinal();
+                if (const auto object = findObject(chunk.size, chunkAlgorithm, chunk.digest))
+                {
+                    chunk.objectid = object->id;
+                }
+                else
+                {
+                    // 按摘要前两位分目录，避免单个目录下文件过多
+                    chunk.path = chunkRoot + chunk.digest.substr(0, 2) + "/" + chunk.digest;
+                    const auto full = target.targetrootpath + chunk.path;
+                    if (written.count(full) == 0)
+                    {
+                        writeChunkFile(full, data, size);
+                        written.insert(full);
+                        storedBytes += chunk.size;
+                    }
+                }
+                manifest.push_back(std::move(chunk));
+            });
+    }
+    catch (const std::exception& e)
+    {
+        logger.error("failed to store chunks of " + file.path + ": " + e.what());
+        for (const auto& full : written)
+        {
+            std::error_code ec;
+            std::filesystem::remove(u8path_from(full), ec);
+        }
+        return false;
+    }
+    m_unsyncedFiles.insert(m_unsyncedFiles.end(), written.begin(), written.end());
+
+    for (auto& chunk : manifest)
+    {
+        // 同一文件中重复出现的新块，以及记录还在但文件丢失后重新写入的块，已有对象记录
+        if (chunk.objectid == 0)
+        {
+            if (auto ret = m_sqliteHelper.query(CatalogQueries::objectByPath, target.id,
+                                                chunk.path);
+                ret && ret->executeStep())
+            {
+                chunk.objectid = ret->getColumn("id").getInt64();
+            }
+        }
+        if (chunk.objectid != 0)
+        {
+            m_sqliteHelper.exec(CatalogQueries::addObjectRef, chunk.objectid);
+        }
+        else
+        {
+            m_sqliteHelper.exec(CatalogQueries::insertObject, target.id, chunk.path, chunk.size,
+                                chunkAlgorithm, chunk.digest);
+            chunk.objectid = m_sqliteHelper.lastInsertRowid();
+        }
+    }
+
+    history.md5 = digest.hexFinal();
+    history.sampledigest = sample.hexFinal();
+    history.samplekb = history.sampledigest.empty() ? 0 : sampleKb();
+    history.copyendtime = Utils::Date::getCurrentDateTime();
+    history.storage = "chunks";
+    history.backuptargetrootid = target.id;
+    history.backuptargetpath.clear();
+    const auto historyid = insertVersion(history, digest);
+    for (std::size_t i = 0; i < manifest.size(); ++i)
+    {
+        m_sqliteHelper.exec(CatalogQueries::insertManifestChunk, historyid,
+                            static_cast<int64_t>(i), manifest[i].objectid, manifest[i].size);
+    }
+    ++m_fileCopyCount;
+    m_dataCopyCount += storedBytes;
+    ++m_chunkedCount;
+    m_chunkedBytes += file.filesize;
+    m_chunkStoredBytes += storedBytes;
+
+    logger.info("chunk file " + file.path + ": " + std::to_string(manifest.size()) +
+                " chunks, " + std::to_string(written.size()) + " new (" +
+                std::to_string(storedBytes) + " bytes)");
+    return true;
+}
+
+bool ServiceRun::storeDelta(const timemachine::FileRecord& file,
+                            const timemachine::Backuptargetroot& target,
+                            timemachine::BackupHistory& history, Digest& digest)
+{
+    Delta::Signature basis;
+    int64_t basisId = 0;
+    int64_t depth = 0;
+    if (auto ret = m_sqliteHelper.query(CatalogQueries::deltaBasis, history.backupfileid);
+        ret && ret->executeStep())
+    {
+        const auto column = ret->getColumn("signature");
+        const auto* blob = column.getBlob();
+        if (Delta::Signature::parse(blob, static_cast<std::size_t>(column.getBytes()), basis))
+        {
+            basisId = ret->getColumn("historyid").getInt64();
+            depth = ret->getColumn("chaindepth").getInt64();
+        }
+    }
+
+    const auto targetPath = u8path_from(target.targetrootpath) / target.targetrootdir;
+    const auto timestamp = uniqueTimestamp();
+    const auto tempFull = (targetPath / ("_" + timestamp + ".part")).u8string();
+    const auto patchDigest = Digest::create(hashAlgorithm());
+    Delta::SignatureBuilder signature(deltaBlockSize());
+    Delta::Signature next;
+    std::string objectDigest;
+    int64_t literalBytes = 0;
+    int64_t storedBytes = 0;
+
+    // 读一遍源文件：同时计算整个文件的摘要、抽样摘要和新签名，内容写入补丁或完整的备份文件
+    auto store = [&](bool delta)
+    {
+        SampleDigest sample(static_cast<uint64_t>(file.filesize),
+                            static_cast<std::size_t>(sampleKb()) * 1024);
+        std::filesystem::create_directories(targetPath);
+        std::ofstream out(u8path_from(tempFull), std::ofstream::binary | std::ofstream::trunc);
+        if (!out)
+        {
+            throw std::runtime_error("cannot create file: " + tempFull);
+        }
+        auto write = [&](const void* data, std::size_t size)
+        {
+            out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+            patchDigest->update(data, size);
+        };
+        std::optional<Delta::Encoder> encoder;
+        if (delta)
+        {
+            encoder.emplace(basis, write);
+        }
+        std::ifstream in(u8path_from(file.path), std::ifstream::binary);
+        if (!in)
+        {
+            throw std::runtime_error("cannot open source file: " + file.path);
+        }
+        std::vector<char> buffer(1 << 20);
+        while (in)
+        {
+            in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            const auto count = static_cast<std::size_t>(in.gcount());
+            if (count == 0)
+            {
+                break;
+            }
+            digest.update(buffer.data(), count);
+            sample.update(buffer.data(), count);
+            signature.update(buffer.data(), count);
+            if (encoder)
+            {
+                encoder->update(buffer.data(), count);
+            }
+            else
+            {
+                write(buffer.data(), count);
+            }
+        }
+        if (in.bad())
+        {
+            throw std::runtime_error("failed to read source file: " + file.path);
+        }
+        if (encoder)
+        {
+            encoder->finish();
+            literalBytes = static_cast<int64_t>(encoder->literalBytes());
+        }
+        out.close();
+        if (!out)
+        {
+            throw std::runtime_error("failed to write file: " + tempFull);
+        }
+        history.md5 = digest.hexFinal();
+        history.sampledigest = sample.hexFinal();
+        objectDigest = patchDigest->hexFinal();
+        next = signature.finish();
+        std::error_code ec;
+        storedBytes = static_cast<int64_t>(std::filesystem::file_size(u8path_from(tempFull), ec));
+    };
+
+    bool delta = basisId != 0 && depth < deltaMaxChain();
+    try
+    {
+        store(delta);
+        // 改动分散在整个文件中时补丁并不比完整版本小多少，保存完整版本以免恢复时还要应用补丁
+        if (delta && storedBytes > file.filesize / 2)
+        {
+            logger.info("delta of " + file.path + " too large (" + std::to_string(storedBytes) +
+                        " bytes), storing whole file");
+            delta = false;
+            store(false);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        logger.error("failed to store " + file.path + " to " + tempFull + ": " + e.what());
+        std::error_code ec;
+        std::filesystem::remove(u8path_from(tempFull), ec);
+        return false;
+    }
+
+    const auto relative = objectPath(
+        target.targetrootdir, (delta ? objectDigest : history.md5) + "_" + timestamp,
+        shardedLayout());
+    const auto targetFull = u8path_from(target.targetrootpath + relative).u8string();
+    try
+    {
+        placeObject(tempFull, targetFull);
+    }
+    catch (const std::exception& e)
+    {
+        logger.error(e.what());
+        std::error_code ec;
+        std::filesystem::remove(u8path_from(tempFull), ec);
+        return false;
+    }
+    if (!delta)
+    {
+        std::error_code ec;
+        const auto perms = std::filesystem::status(u8path_from(file.path), ec).permissions();
+        if (!ec)
+        {
+            std::filesystem::permissions(u8path_from(targetFull), perms, ec);
+        }
+    }
+    m_unsyncedFiles.push_back(targetFull);
+
+    history.copyendtime = Utils::Date::getCurrentDateTime();
+    history.samplekb = history.sampledigest.empty() ? 0 : sampleKb();
+    history.backuptargetrootid = target.id;
+    history.backuptargetpath = relative;
+    if (delta)
+    {
+        history.storage = "delta";
+        history.basehistoryid = basisId;
+        history.chaindepth = depth + 1;
+        m_sqliteHelper.exec(CatalogQueries::insertObject, history.backuptargetrootid,
+                            history.backuptargetpath, storedBytes, hashAlgorithm(), objectDigest);
+    }
+    else
+    {
+        m_sqliteHelper.exec(CatalogQueries::insertObject, history.backuptargetrootid,
+                            history.backuptargetpath, file.filesize, history.hashalgo,
+                            history.md5);
+    }
+    const auto historyid = insertVersion(history, digest);
+    m_sqliteHelper.exec(CatalogQueries::storeSignature, history.backupfileid, historyid,
+                        next.serialize());
+    ++m_fileCopyCount;
+    m_dataCopyCount += storedBytes;
+    if (!delta)
+    {
+        logger.info("copy file from " + file.path + " to " + targetFull);
+        return true;
+    }
+    ++m_deltaCount;
+    m_deltaBytes += file.filesize;
+    m_deltaStoredBytes += storedBytes;
+    logger.info("delta file " + file.path + " against version " + std::to_string(basisId) +
+                ": " + std::to_string(literalBytes) + " changed bytes, patch " +
+                std::to_string(storedBytes) + " bytes to " + targetFull);
+    return true;
+}
+
+std::optional<ServiceRun::StoredObject> ServiceRun::findObject(int64_t filesize,
+                                                                const std::string& algorithm,
+                                                                const std::string& digest)
+{
+    // 只使用当前在线的目标上确实存在的对象
+    if (auto ret = m_sqliteHelper.query(CatalogQueries::findObject, filesize, algorithm, digest);
+        ret)
+    {
+        while (ret->executeStep())
+        {
+            StoredObject object;
+            object.id = ret->getColumn("id").getInt64();
+            object.backuptargetrootid = ret->getColumn("backuptargetrootid").getInt();
+            object.backuptargetpath = ret->getColumn("backuptargetpath").getString();
+            const auto root = getTargetrootPath(object.backuptargetrootid);
+            std::error_code ec;
+            if (!root.empty() &&
+                std::filesystem::is_regular_file(u8path_from(root + object.backuptargetpath), ec))
+            {
+                return object;
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+void ServiceRun::deleteVersion(const timemachine::BackupHistory& history)
+{
+    m_sqliteHelper.exec("delete from tb_backfilehistory where id=?", history.id);
+    m_sqliteHelper.exec(CatalogQueries::deleteChunkDigests, history.id);
+    m_sqliteHelper.exec(CatalogQueries::deleteSignature, history.id);
+    if (history.storage != "chunks")
+    {
+        releaseObject(history.backuptargetrootid, history.backuptargetpath,
+                      history.backuptargetfullpath);
+        return;
+    }
+    // 先读出块清单再逐个释放，不在遍历中修改对象表
+    std::vector<std::pair<int, std::string>> chunks;
+    if (auto ret = m_sqliteHelper.query(CatalogQueries::manifestByHistory, history.id); ret)
+    {
+        while (ret->executeStep())
+        {
+            chunks.emplace_back(ret->getColumn("backuptargetrootid").getInt(),
+                                ret->getColumn("backuptargetpath").getString());
+        }
+    }
+    m_sqliteHelper.exec(CatalogQueries::deleteManifest, history.id);
+    for (const auto& [rootid, path] : chunks)
+    {
+        releaseObject(rootid, path, getTargetrootPath(rootid) + path);
+    }
+}
+
+void ServiceRun::releaseObject(int targetrootid, const std::string& targetpath,
+                               const std::string& fullpath)
 {
-    logger.info("init db...");
-    if (!m_sqliteHelper.valid())
+    // 没有对象记录的旧版本按原来的方式直接删除文件
+    bool unlink = true;
+    if (m_sqliteHelper.exec(CatalogQueries::releaseObject, targetrootid, targetpath) > 0)
     {
-        logger.error("SQLite init failed");
+        int64_t id = 0;
+        if (auto ret = m_sqliteHelper.query(CatalogQueries::objectByPath, targetrootid, targetpath);
+            ret && ret->executeStep())
+        {
+            id = ret->getColumn("id").getInt64();
+            unlink = ret->getColumn("refcount").getInt64() <= 0;
+        }
+        if (unlink && id != 0)
+        {
+            m_sqliteHelper.exec(CatalogQueries::deleteObject, id);
+        }
+    }
+    if (!unlink)
+    {
+        return;
+    }
+    std::error_code ec;
+    if (std::filesystem::remove(u8path_from(fullpath), ec))
+    {
+        logger.info("delete backup file:" + fullpath);
+    }
+    else if (ec)
+    {
+        logger.error("failed to delete " + fullpath + ": " + ec.message());
+    }
+    else
+    {
+        logger.info("backup file already missing:" + fullpath);
     }
 }
 
-void ServiceRun::loadBackupRoot()
+void ServiceRun::XCopy(const timemachine::Backuproot& backuproot)
 {
-    logger.info("loadBackupRoot");
-    if (auto res = m_sqliteHelper.prepareQuery("select * from tb_backuproot"); res)
+    logger.info("Loading CurrentFile In Db:" + std::to_string(backuproot.id));
+    m_deltaRoot = deltaRoot(backuproot.rootpath);
+    m_copyFailed = false;
+    // 数据库按 filepath 排序流式读出，与同样有序的扫描结果归并：只在扫描中出现的是新文件，
+    // 两边都有的需要比较，只在数据库中出现的已从来源删除。
+    // 文件按 (backuprootid, filepath) 索引顺序读出，最新版本取自文件表上的冗余列。
+    // 每次批量提交前关闭游标、之后从上一条路径处重新定位，游标不会一直占着读快照，
+    // WAL 在 checkpoint 之后可以从头复用，不会随整个来源的文件数增长
+    std::optional<CachedStatement> catalog;
+    timemachine::BackupFile current;
+    bool hasCurrent = false;
+    auto nextCatalog = [&]()
     {
-        while (res->executeStep())
+        if (!catalog)
         {
-            timemachine::Backuproot backuproot;
-            backuproot.id = res->getColumn("id").getInt();
-            backuproot.rootpath = res->getColumn("rootpath").getString();
-            if (!std::filesystem::exists(u8path_from(backuproot.rootpath)))
-            {
-                logger.error("No found backup source: " + backuproot.rootpath);
-            }
-            else
+            catalog.emplace(m_sqliteHelper.query(CatalogQueries::latestVersionsByRoot,
+                                                 backuproot.id, current.filepath));
+            if (!*catalog)
             {
-                m_backupRootList.emplace_back(std::move(backuproot));
+                throw std::runtime_error("内部错误！数据库异常，无法读取备份目录");
             }
         }
-    }
+        if ((hasCurrent = (*catalog)->executeStep()))
+        {
+            auto& row = **catalog;
+            current.id = row.getColumn("id").getInt64();
+            current.filepath = row.getColumn("filepath").getString();
+            current.historyid = row.getColumn("historyid").getInt64();
+            current.motifytime = row.getColumn("motifytime").getInt64();
+            current.filesize = row.getColumn("filesize").getInt64();
+            current.md5 = row.getColumn("md5").getString();
+            current.hashalgo = row.getColumn("hashalgo").getString();
+            current.sampledigest = row.getColumn("sampledigest").getString();
+            current.samplekb = row.getColumn("samplekb").getInt64();
+        }
+    };
+    std::size_t deletedCount = 0;
+    auto reportDeleted = [&]()
+    {
+        ++deletedCount;
+        logger.info("file deleted from source:" + current.filepath);
+        nextCatalog();
+    };
+    nextCatalog();
 
-    if (auto res = m_sqliteHelper.prepareQuery("select * from tb_backuptargetroot"); res)
+    // 目录写入按批提交，每批提交前先把本批拷贝的文件刷盘，崩溃时不会留下指向未落盘数据的记录
+    TransactionBatch batch(m_sqliteHelper, batchRows(), batchMillis(),
+                           [this, &catalog]()
+                           {
+                               catalog.reset();
+                               Utils::syncFiles(m_unsyncedFiles);
+                               m_unsyncedFiles.clear();
+                           });
+    // 中途抛出异常时，在 batch 析构提交之前把已排队的拷贝写入本批，
+    // 这些记录同样先刷盘再提交，不会在事务之外逐条自动提交
+    struct DrainOnUnwind
     {
-        while (res->executeStep())
+        ServiceRun& self;
+        int exceptions = std::uncaught_exceptions();
+        ~DrainOnUnwind()
         {
-            timemachine::Backuptargetroot backuptargetroot;
-            backuptargetroot.id = res->getColumn("id").getInt();
-            backuptargetroot.targetrootpath =
-                res->getColumn("targetrootpath").getString();
-            backuptargetroot.targetrootdir = targetBkDirName;
-
-            auto u8path = u8path_from(backuptargetroot.targetrootpath);
-            if (!std::filesystem::exists(u8path))
+            if (std::uncaught_exceptions() <= exceptions)
             {
-                std::filesystem::create_directory(u8path);
+                return;
             }
-            if (!std::filesystem::exists(u8path))
+            try
             {
-                logger.error("No found backup target: " +
-                             backuptargetroot.targetrootpath);
+                if (!self.m_sqliteHelper.inTransaction())
+                {
+                    self.m_sqliteHelper.beginTransaction();
+                }
+                self.drainCopies(true);
             }
-            else
+            catch (const std::exception& e)
             {
-                try
+                logger.error(std::string("failed to record queued copies: ") + e.what());
+            }
+        }
+    } drainOnUnwind{*this};
+
+    // 扫描与比较、拷贝流水线进行：扫描线程最多领先 scan.buffer 个条目
+    logger.info("begin xcopy! scanning:" + backuproot.rootpath);
+    FileScanner scanner(scanThreads(), scanBuffer());
+    std::size_t counter = 0;
+    auto timestamp = Utils::getMilliTimeStamp() / 1000;
+    const bool completed = scanner.scan(
+        backuproot.rootpath,
+        [&](timemachine::FileRecord& record)
+        {
+            ++counter;
+            batch.add();
+            const auto nowSec = Utils::getMilliTimeStamp() / 1000;
+            if (nowSec != timestamp)
+            {
+                timestamp = nowSec;
+                // 扫描未结束时总数未知，只报告累计值
+                const auto listed = scanner.listedCount();
+                if (scanner.scanComplete())
                 {
-                    backuptargetroot.spaceRemain =
-                        std::filesystem::space(u8path).available;
+                    logger.info("copy progress:" + std::to_string(counter * 100 / listed) +
+                                "%  " + std::to_string(counter) + "/" + std::to_string(listed));
                 }
-                catch (const std::exception& e)
+                else
                 {
-                    logger.error(std::string("space() failed for: ") +
-                                 backuptargetroot.targetrootpath + " -> " + e.what());
-                    backuptargetroot.spaceRemain = 0;
+                    logger.info("copy progress: " + std::to_string(counter) + "/" +
+                                std::to_string(listed) + "+ (scanning)  copied:" +
+                                std::to_string(m_fileCopyCount));
                 }
-                m_backupTargetRootList.emplace_back(std::move(backuptargetroot));
             }
+
+            while (hasCurrent && current.filepath < record.path)
+            {
+                reportDeleted();
+            }
+            bool ok = false;
+            if (hasCurrent && current.filepath == record.path)
+            {
+                ok = backupFile(backuproot, record, &current);
+                nextCatalog();
+            }
+            else
+            {
+                ok = backupFile(backuproot, record, nullptr);
+            }
+            // 顺便写入已完成的并行拷贝；拷贝失败时与同步拷贝一样中止本次扫描
+            return drainCopies(false) && ok;
+        });
+    // 剩余未满一批的比较在本批事务内完成；扫描中止时直接放弃
+    if (completed && !flushPendingCompares())
+    {
+        logger.error("内部错误！比较文件失败");
+    }
+    m_pendingCompares.clear();
+    // 等排队的拷贝全部完成并写入目录，之后才能提交最后一批（扫描中止时也写入已完成的拷贝）
+    if (!drainCopies(true))
+    {
+        logger.error("拷贝错误！部分文件未能备份");
+    }
+    if (completed)
+    {
+        while (hasCurrent)
+        {
+            reportDeleted();
         }
     }
+    logger.info("xcopy finished! total:" + std::to_string(counter) +
+                " deleted:" + std::to_string(deletedCount) +
+                " digest cache hits:" + std::to_string(m_digestCacheHits) +
+                " sample rejects:" + std::to_string(m_sampleRejects) +
+                " deduplicated:" + std::to_string(m_dedupCount) + " (" +
+                std::to_string(m_dedupBytes) + " bytes)" +
+                " chunked:" + std::to_string(m_chunkedCount) + " (stored " +
+                std::to_string(m_chunkStoredBytes) + " of " + std::to_string(m_chunkedBytes) +
+                " bytes)" + " appended:" + std::to_string(m_appendCount) + " (" +
+                std::to_string(m_appendBytes) + " bytes)" + " delta:" +
+                std::to_string(m_deltaCount) + " (stored " + std::to_string(m_deltaStoredBytes) +
+                " of " + std::to_string(m_deltaBytes) + " bytes)" +
+                " copy methods: " + CopyEngine::instance().summary() +
+                " io_uring:" + std::to_string(m_uringCopyCount));
 }
 
-void ServiceRun::loadAllFiles(const std::string& pathName,
-                              std::vector<std::string>& fileList)
+bool ServiceRun::backupFile(const timemachine::Backuproot& backuproot,
+                            const timemachine::FileRecord& record,
+                            const timemachine::BackupFile* known)
 {
-    for (const auto& entry :
-         std::filesystem::recursive_directory_iterator(u8path_from(pathName)))
+    const auto& file = record.path;
+    int64_t id = 0;
+    if (known == nullptr)
     {
-        if (!entry.is_directory())
+        // 路径作为参数绑定，含引号、反斜杠的文件名也能原样保存
+        if (m_sqliteHelper.exec("insert into tb_backfiles "
+                                "(backuprootid,filepath,versionhistorycnt,lastbackuptime) "
+                                "values (?,?,0,datetime('now', 'localtime'))",
+                                backuproot.id, file) != 1)
         {
-            const auto u8pathStr = entry.path().u8string();
-            if (u8pathStr.find("/.") == std::string::npos &&
-                u8pathStr.find("\\.") == std::string::npos)
-            {
-                fileList.emplace_back(u8pathStr);
-            }
+            logger.error("内部错误！数据库异常，退出...");
+            return false;
         }
+        id = m_sqliteHelper.lastInsertRowid();
+    }
+    else
+    {
+        id = known->id;
     }
-}
 
-std::optional<timemachine::Backuptargetroot> ServiceRun::getAvailableTarget(
-    uintmax_t needspace)
-{
-    std::vector<timemachine::Backuptargetroot> available;
-    available.reserve(m_backupTargetRootList.size());
-    for (auto& br : m_backupTargetRootList)
+    if (known != nullptr && known->historyid != 0)
     {
-        try
+        const auto lastmotify = known->motifytime;
+        const auto filesize = known->filesize;
+        const auto lastWriteTime = record.motifytime;
+        if (sameMotifyTime(lastmotify, lastWriteTime) && filesize == record.filesize)
         {
-            br.spaceRemain =
-                std::filesystem::space(u8path_from(br.targetrootpath)).available;
+            return true;
         }
-        catch (const std::exception& e)
+
+        logger.info("motify time indb:" + std::to_string(lastmotify) +
+                    " real:" + std::to_string(lastWriteTime) +
+                    " filesize indb:" + std::to_string(filesize) +
+                    " real:" + std::to_string(record.filesize));
+
+        // 用最新版本记录的算法重新计算摘要；不认识的算法（更新的程序写入）直接备份新版本
+        if (filesize == record.filesize && Digest::isSupported(known->hashalgo))
         {
-            logger.error(std::string("failed to query space for ") + br.targetrootpath +
-                         " -> " + e.what());
-            br.spaceRemain = 0;
+            // 同一 inode 在大小、修改时间、ctime 都未变时已经计算过，直接使用缓存的摘要
+            if (const auto cached = cachedDigest(record, known->hashalgo); !cached.empty())
+            {
+                ++m_digestCacheHits;
+                return compareDigest({record, *known}, cached);
+            }
+            // 先比较开头、中间、末尾的抽样摘要：不一致说明内容已改变，
+            // 直接备份新版本（拷贝时计算完整摘要），文件只读一遍
+            if (!known->sampledigest.empty())
+            {
+                const auto sample = FileHasher::threadLocal().sample(
+                    file, static_cast<uint64_t>(record.filesize),
+                    static_cast<std::size_t>(known->samplekb) * 1024);
+                if (!sample.empty() && sample != known->sampledigest)
+                {
+                    ++m_sampleRejects;
+                    logger.info("sample digest indb:" + known->sampledigest + " real:" + sample);
+                    return copyVersion(record, id);
+                }
+            }
+            if (known->hashalgo == "md5")
+            {
+                m_pendingCompares.push_back({record, *known});
+                if (m_pendingCompares.size() >= pendingCompareLimit())
+                {
+                    return flushPendingCompares();
+                }
+                return true;
+            }
+            const auto digest = Utils::getFileDigest(file, known->hashalgo);
+            cacheDigest(record, known->hashalgo, digest);
+            return compareDigest({record, *known}, digest);
         }
-
-        if (br.spaceRemain > needspace)
+        // 文件变大时先看是否只在末尾追加了内容（日志等），是则只保存追加的部分；
+        // 按差量保存的文件交给差量编码（追加的内容成为字面数据），签名保持连续
+        if (record.filesize > filesize && filesize >= appendMinBytes() && appendEnabled() &&
+            Digest::isSupported(known->hashalgo) &&
+            !(m_deltaRoot && deltaSize(static_cast<uint64_t>(record.filesize))))
         {
-            available.emplace_back(br);
+            return storeAppend(record, *known, id);
         }
     }
 
-    if (!available.empty())
+    return copyVersion(record, id);
+}
+
+bool ServiceRun::compareDigest(const PendingCompare& pending, const std::string& digest)
+{
+    const auto& known = pending.known;
+    if (digest == known.md5)
     {
-        return *std::max_element(available.begin(), available.end(),
-                                 [](const auto& a, const auto& b)
-                                 { return a.spaceRemain < b.spaceRemain; });
+        logger.info("historyfile id=[" + std::to_string(known.historyid) + "] backupid:[" +
+                    std::to_string(known.id) + "] not changed but motifytime diff, correcting...");
+        m_sqliteHelper.exec(
+            "update tb_backfilehistory set motifytime=? where backupfileid=? and id=?",
+            pending.record.motifytime, known.id, known.historyid);
+        m_sqliteHelper.exec("update tb_backfiles set lastmotifytime=? where id=?",
+                            pending.record.motifytime, known.id);
+        return true;
     }
-    return std::nullopt;
+    logger.info("hash indb:" + known.md5 + " real:" + digest);
+    return copyVersion(pending.record, known.id);
 }
 
-void ServiceRun::copyFile(const std::string& source, const std::string& dest)
+bool ServiceRun::flushPendingCompares()
 {
-    try
+    if (m_pendingCompares.empty())
     {
-        const auto destPath = u8path_from(dest);
-        const auto destDir = destPath.parent_path();
-        if (!std::filesystem::exists(destDir))
+        return true;
+    }
+    // 硬链接等同一 inode 的多个路径只计算一次，其余视为缓存命中
+    std::vector<std::string> paths;
+    std::vector<std::size_t> owners;  // 每个路径对应的待比较项
+    std::vector<std::size_t> slots;   // 每个待比较项对应的路径
+    std::map<std::tuple<uint64_t, uint64_t, int64_t>, std::size_t> inodes;
+    paths.reserve(m_pendingCompares.size());
+    slots.reserve(m_pendingCompares.size());
+    for (std::size_t i = 0; i < m_pendingCompares.size(); ++i)
+    {
+        const auto& record = m_pendingCompares[i].record;
+        if (record.changetime != 0)
         {
-            std::filesystem::create_directories(destDir);
+            const auto [it, inserted] = inodes.emplace(
+                std::make_tuple(record.device, record.inode, record.changetime), paths.size());
+            if (!inserted)
+            {
+                ++m_digestCacheHits;
+                slots.push_back(it->second);
+                continue;
+            }
         }
-        std::filesystem::copy_file(u8path_from(source), destPath,
-                                   std::filesystem::copy_options::overwrite_existing);
+        slots.push_back(paths.size());
+        owners.push_back(i);
+        paths.push_back(record.path);
     }
-    catch (const std::exception& e)
+    const auto digests = Md5Multi::hashFiles(paths);
+    for (std::size_t i = 0; i < digests.size(); ++i)
     {
-        logger.error(e.what());
-        throw;  // 保留原始异常信息，避免切片
+        cacheDigest(m_pendingCompares[owners[i]].record, "md5", digests[i]);
     }
+    bool ok = true;
+    for (std::size_t i = 0; i < m_pendingCompares.size() && ok; ++i)
+    {
+        ok = compareDigest(m_pendingCompares[i], digests[slots[i]]);
+    }
+    m_pendingCompares.clear();
+    return ok;
 }
 
-bool ServiceRun::exeCopy(const std::string& fileName, int64_t backupfileid)
+std::string ServiceRun::cachedDigest(const timemachine::FileRecord& record,
+                                     const std::string& algorithm)
 {
-    const auto filePath = u8path_from(fileName);
-    const auto fileSize = std::filesystem::file_size(filePath);
-    const auto lastWriteTime = Utils::getSysFileMilliTimeStamp(filePath);
-
-    const auto backuptargetroot = getAvailableTarget(fileSize);
-    if (!backuptargetroot)
+    if (!digestCacheEnabled() || record.changetime == 0)
     {
-        logger.error("no space in all targetbackups! need:" + std::to_string(fileSize));
-        return false;
+        return {};
     }
-
-    std::string md5str;
-    try
+    if (auto ret = m_sqliteHelper.query(CatalogQueries::cachedDigest, record.device, record.inode,
+                                        record.filesize, record.motifytime, record.changetime,
+                                        algorithm);
+        ret && ret->executeStep())
     {
-        md5str = Utils::getFileMD5(fileName);
+        return ret->getColumn("digest").getString();
     }
-    catch (const std::exception& e)
+    return {};
+}
+
+void ServiceRun::cacheDigest(const timemachine::FileRecord& record, const std::string& algorithm,
+                             const std::string& digest)
+{
+    if (!digestCacheEnabled() || record.changetime == 0 || digest.empty())
     {
-        logger.error(e.what());
-        // md5 失败仍可继续（会产生无 md5 的记录）
+        return;
     }
-
-    // 使用 filesystem::path 构造目标路径更稳健
-    const auto targetPath =
-        u8path_from(backuptargetroot->targetrootpath) / backuptargetroot->targetrootdir;
-    const std::string name = md5str + "_" + std::to_string(Utils::getMilliTimeStamp());
-    const auto targetFull = (targetPath / name).u8string();
-    const auto targetSave =
-        std::string("/") + backuptargetroot->targetrootdir + "/" + name;
-
-    const auto begincopysingle = Utils::Date::getCurrentDateTime();
-    try
+    // 计算期间文件可能被修改：重新取一次属性，与扫描时完全一致才写入缓存
+    timemachine::FileRecord now;
+    if (!FileScanner::statFile(record.path, now) || now.device != record.device ||
+        now.inode != record.inode || now.filesize != record.filesize ||
+        now.motifytime != record.motifytime || now.changetime != record.changetime)
     {
-        copyFile(fileName, targetFull);
+        return;
     }
-    catch (const std::exception&)
+    m_sqliteHelper.exec(CatalogQueries::storeCachedDigest, record.device, record.inode,
+                        record.filesize, record.motifytime, record.changetime, algorithm, digest,
+                        Utils::getMilliTimeStamp() / 1000);
+}
+
+bool ServiceRun::copyVersion(const timemachine::FileRecord& record, int64_t backupfileid)
+{
+    if (!exeCopy(record, backupfileid))
     {
-        logger.error("failed to copy file from " + fileName + " to " + targetFull);
+        logger.error("拷贝错误！退出...");
         return false;
     }
-
-    m_sqliteHelper.execSql(
-        "insert into tb_backfilehistory "
-        "(backupfileid,backupid,motifytime,filesize,copystarttime,copyendtime,"
-        "backuptargetpath,backuptargetrootid,md5)"
-        " values (" +
-        std::to_string(backupfileid) + "," + std::to_string(m_backupId) + "," +
-        std::to_string(lastWriteTime) + "," + std::to_string(fileSize) + ",'" +
-        begincopysingle + "','" + Utils::Date::getCurrentDateTime() + "','" + targetSave +
-        "'," + std::to_string(backuptargetroot->id) + ",'" + md5str + "')");
-
-    logger.info("copy file from " + fileName + " to " + targetFull);
     return true;
 }
 
-void ServiceRun::XCopy(const timemachine::Backuproot& backuproot)
+bool ServiceRun::storeAppend(const timemachine::FileRecord& record,
+                             const timemachine::BackupFile& known, int64_t backupfileid)
 {
-    logger.info("Loading File list:" + backuproot.rootpath);
-    std::vector<std::string> fileList;
-    fileList.reserve(1024);
-    std::map<std::string, int> mapFile;
-    loadAllFiles(backuproot.rootpath, fileList);
-    logger.info("Loading CurrentFile In Db:" + std::to_string(backuproot.id));
-
-    const std::string sqlquery =
-        "select id,filepath from tb_backfiles where backuprootid=" +
-        std::to_string(backuproot.id);
-    if (auto stmt = m_sqliteHelper.prepareQuery(sqlquery); stmt)
+    int64_t depth = 0;
+    if (auto ret = m_sqliteHelper.query(CatalogQueries::versionStorage, known.historyid);
+        ret && ret->executeStep())
     {
-        while (stmt->executeStep())
-        {
-            const auto filepath = stmt->getColumn("filepath").getText();
-            mapFile.emplace(filepath, stmt->getColumn("id").getInt());
-        }
+        depth = ret->getColumn("chaindepth").getInt64();
     }
-
-    logger.info("begin xcopy! total:" + std::to_string(fileList.size()));
-    std::size_t counter = 0;
-    auto timestamp = Utils::getMilliTimeStamp() / 1000;
-    for (const auto& file : fileList)
+    if (depth >= appendMaxChain())
     {
-        if (file.find("/.") != std::string::npos || file.find("\\.") != std::string::npos)
-        {
-            continue;
-        }
-
-        ++counter;
-        const auto nowSec = Utils::getMilliTimeStamp() / 1000;
-        if (nowSec != timestamp)
+        return copyVersion(record, backupfileid);
+    }
+    // 原长度部分的抽样摘要不一致时肯定不是单纯追加，不必读完整个文件
+    if (!known.sampledigest.empty())
+    {
+        const auto sample = FileHasher::threadLocal().sample(
+            record.path, static_cast<uint64_t>(known.filesize),
+            static_cast<std::size_t>(known.samplekb) * 1024);
+        if (!sample.empty() && sample != known.sampledigest)
         {
-            timestamp = nowSec;
-            logger.info(
-                "copy progress:" + std::to_string(counter * 100 / fileList.size()) +
-                "%  " + std::to_string(counter) + "/" + std::to_string(fileList.size()));
+            ++m_sampleRejects;
+            return copyVersion(record, backupfileid);
         }
+    }
 
-        int64_t id = 0;
-        auto it = mapFile.find(file);
-        if (it == mapFile.end())
-        {
-            const std::string safeFile =
-                Utils::replace(Utils::replace(file, "\\", "\\\\"), "'", "\\'");
-            const std::string insertSql =
-                "select * from tb_backfiles where filepath='" + safeFile +
-                "' and backuprootid=" + std::to_string(backuproot.id);
-
-            m_sqliteHelper.execSql(
-                "insert into tb_backfiles "
-                "(backuprootid,filepath,versionhistorycnt,lastbackuptime) "
-                "values (" +
-                std::to_string(backuproot.id) + ",'" + safeFile +
-                "',0,datetime('now', 'localtime'))");
+    const auto appendSize = record.filesize - known.filesize;
+    const auto backuptargetroot = getAvailableTarget(static_cast<uintmax_t>(appendSize));
+    if (!backuptargetroot)
+    {
+        logger.error("no space in all targetbackups! need:" + std::to_string(appendSize));
+        return false;
+    }
+    const auto targetPath =
+        u8path_from(backuptargetroot->targetrootpath) / backuptargetroot->targetrootdir;
+    const auto timestamp = uniqueTimestamp();
+    const auto tempFull = (targetPath / ("_" + timestamp + ".part")).u8string();
 
-            if (auto newStmt = m_sqliteHelper.prepareQuery(insertSql);
-                newStmt && newStmt->executeStep())
-            {
-                id = newStmt->getColumn("id").getInt();
-            }
-            else
-            {
-                logger.error("内部错误！数据库异常，退出...");
-                break;
-            }
-        }
-        else
-        {
-            id = it->second;
-        }
+    timemachine::BackupHistory history;
+    history.backupfileid = backupfileid;
+    history.filesize = record.filesize;
+    history.motifytime = record.motifytime;
+    history.hashalgo = hashAlgorithmFor(static_cast<uint64_t>(record.filesize));
+    history.copystarttime = Utils::Date::getCurrentDateTime();
+    // 读一遍源文件：原长度部分按最新版本的算法核对，追加部分写入备份文件并单独计算摘要（对象），
+    // 整个文件的摘要作为新版本的摘要
+    const auto digest = Digest::create(history.hashalgo);
+    const auto prefix = Digest::create(known.hashalgo);
+    const auto tail = Digest::create(hashAlgorithm());
+    SampleDigest sample(static_cast<uint64_t>(record.filesize),
+                        static_cast<std::size_t>(sampleKb()) * 1024);
+    std::string tailDigest;
+    try
+    {
+        std::filesystem::create_directories(targetPath);
+        history.md5 = Utils::copyFileTailWithDigest(record.path, tempFull,
+                                                    static_cast<uint64_t>(known.filesize),
+                                                    *prefix, *tail, *digest, &sample);
+        history.sampledigest = sample.hexFinal();
+        tailDigest = tail->hexFinal();
+    }
+    catch (const std::exception& e)
+    {
+        logger.error("failed to copy appended data from " + record.path + " to " + tempFull +
+                     ": " + e.what());
+        std::error_code ec;
+        std::filesystem::remove(u8path_from(tempFull), ec);
+        return false;
+    }
 
-        if (auto histStmt = m_sqliteHelper.prepareQuery(
-                "select * from tb_backfilehistory where backupfileid=" +
-                std::to_string(id) + " order by id desc limit 1");
-            histStmt && histStmt->executeStep())
-        {
-            const auto lastmotify = histStmt->getColumn("motifytime").getInt64();
-            const auto filesize = histStmt->getColumn("filesize").getInt64();
-            const std::string hash = histStmt->getColumn("md5").getString();
-            const auto fidid = histStmt->getColumn("id").getInt();
-            const auto fileU8 = u8path_from(file);
-            const auto lastWriteTime = Utils::getSysFileMilliTimeStamp(fileU8);
-            if (lastmotify == lastWriteTime &&
-                filesize == std::filesystem::file_size(fileU8))
-            {
-                continue;
-            }
+    // 原有内容被改写，或读取期间文件又有变化：按普通方式备份
+    std::error_code ec;
+    const auto written = std::filesystem::file_size(u8path_from(tempFull), ec);
+    if (prefix->hexFinal() != known.md5 || ec ||
+        written != static_cast<std::uintmax_t>(appendSize))
+    {
+        std::filesystem::remove(u8path_from(tempFull), ec);
+        logger.info("not an append, copying whole file: " + record.path);
+        return copyVersion(record, backupfileid);
+    }
 
-            logger.info("motify time indb:" + std::to_string(lastmotify) +
-                        " real:" + std::to_string(lastWriteTime) +
-                        " filesize indb:" + std::to_string(filesize) +
-                        " real:" + std::to_string(std::filesystem::file_size(fileU8)));
+    const auto relative = objectPath(backuptargetroot->targetrootdir,
+                                     tailDigest + "_" + timestamp, shardedLayout());
+    const auto targetFull = u8path_from(backuptargetroot->targetrootpath + relative).u8string();
+    try
+    {
+        placeObject(tempFull, targetFull);
+    }
+    catch (const std::exception& e)
+    {
+        logger.error(e.what());
+        std::filesystem::remove(u8path_from(tempFull), ec);
+        return false;
+    }
+    m_unsyncedFiles.push_back(targetFull);
 
-            if (lastmotify != lastWriteTime &&
-                filesize == std::filesystem::file_size(fileU8))
-            {
-                const auto md5str = Utils::getFileMD5(file);
-                if (md5str == hash)
-                {
-                    logger.info("historyfile id=[" + std::to_string(fidid) +
-                                "] backupid:[" + std::to_string(id) +
-                                "] not changed but motifytime diff, correcting...");
-                    m_sqliteHelper.execSql("update tb_backfilehistory set motifytime=" +
-                                           std::to_string(lastWriteTime) +
-                                           " where backupfileid=" + std::to_string(id) +
-                                           " and id=" + std::to_string(fidid));
-                    continue;
-                }
-                logger.info("hash indb:" + hash + " real:" + md5str);
-            }
-        }
+    history.copyendtime = Utils::Date::getCurrentDateTime();
+    history.samplekb = history.sampledigest.empty() ? 0 : sampleKb();
+    history.storage = "append";
+    history.basehistoryid = known.historyid;
+    history.chaindepth = depth + 1;
+    history.backuptargetrootid = backuptargetroot->id;
+    history.backuptargetpath = relative;
+    m_sqliteHelper.exec(CatalogQueries::insertObject, history.backuptargetrootid,
+                        history.backuptargetpath, appendSize, hashAlgorithm(), tailDigest);
+    insertVersion(history, *digest);
+    ++m_fileCopyCount;
+    m_dataCopyCount += appendSize;
+    ++m_appendCount;
+    m_appendBytes += appendSize;
 
-        if (!exeCopy(file, id))
-        {
-            logger.error("拷贝错误！退出...");
-            break;
-        }
-        ++m_fileCopyCount;
-        m_dataCopyCount += std::filesystem::file_size(u8path_from(file));
-    }
+    logger.info("append file " + record.path + ": +" + std::to_string(appendSize) +
+                " bytes to " + targetFull);
+    return true;
 }
 
 int ServiceRun::beginbackup()
 {
-    m_sqliteHelper.execSql(
-        "insert into tb_backup (begintime) values(datetime('now', 'localtime'))");
-    if (auto ret = m_sqliteHelper.prepareQuery("select last_insert_rowid() as id");
-        ret && ret->executeStep())
+    if (m_sqliteHelper.exec(
+            "insert into tb_backup (begintime) values(datetime('now', 'localtime'))") == 1)
     {
-        return ret->getColumn("id").getInt();
+        return static_cast<int>(m_sqliteHelper.lastInsertRowid());
     }
     return -1;
 }
 
 void ServiceRun::finishbackup()
 {
-    m_sqliteHelper.execSql(
-        "update tb_backup set endtime=datetime('now', 'localtime'),filecopycount=" +
-        std::to_string(m_fileCopyCount) + ",datacopycount=" +
-        std::to_string(m_dataCopyCount) + " where id=" + std::to_string(m_backupId));
+    m_sqliteHelper.exec(
+        "update tb_backup set endtime=datetime('now', 'localtime'),filecopycount=?,"
+        "datacopycount=? where id=?",
+        m_fileCopyCount, m_dataCopyCount, m_backupId);
+    m_sqliteHelper.exec(CatalogQueries::pruneDigestCache,
+                        Utils::getMilliTimeStamp() / 1000 - digestCacheDays() * 86400);
 }
 
 void ServiceRun::deleteByBackuprootid(int64_t rootid)
@@ -371,8 +1837,7 @@ void ServiceRun::deleteByBackuprootid(int64_t rootid)
     std::size_t counter = 0;
     auto timestamp = Utils::getMilliTimeStamp() / 1000;
     logger.info("loading files backuprootid=" + std::to_string(rootid));
-    if (auto ret = m_sqliteHelper.prepareQuery(
-            "select id from tb_backfiles where backuprootid=" + std::to_string(rootid));
+    if (auto ret = m_sqliteHelper.query(CatalogQueries::fileIdsByRoot, rootid);
         ret)
     {
         std::vector<int64_t> tbbackfilesList;
@@ -381,27 +1846,30 @@ void ServiceRun::deleteByBackuprootid(int64_t rootid)
             tbbackfilesList.push_back(ret->getColumn("id").getInt());
         }
 
+        TransactionBatch batch(m_sqliteHelper, batchRows(), batchMillis());
         for (const auto id : tbbackfilesList)
         {
-            if (auto subret = m_sqliteHelper.prepareQuery(
-                    "select id,backuptargetpath from tb_backfilehistory where "
-                    "backupfileid=" +
-                    std::to_string(id));
-                subret && subret->executeStep())
+            batch.add();
+            // 先读出全部版本再逐个删除，不在遍历中修改同一张表
+            std::vector<timemachine::BackupHistory> versions;
+            if (auto subret = m_sqliteHelper.query(CatalogQueries::historyByFile, id); subret)
             {
-                // TODO 修复路径错误
-                const auto file = subret->getColumn("backuptargetpath").getString();
-                const auto u8path = u8path_from(file);
-                if (std::filesystem::exists(u8path))
-                {
-                    std::filesystem::remove(u8path);
-                }
-                else
+                while (subret->executeStep())
                 {
-                    logger.error("not found target path:" + file);
+                    timemachine::BackupHistory history;
+                    history.id = subret->getColumn("id").getInt();
+                    history.backuptargetrootid = subret->getColumn("backuptargetrootid").getInt();
+                    history.backuptargetpath = subret->getColumn("backuptargetpath").getString();
+                    history.storage = subret->getColumn("storage").getString();
+                    history.backuptargetfullpath =
+                        getTargetrootPath(history.backuptargetrootid) + history.backuptargetpath;
+                    versions.push_back(std::move(history));
                 }
-                m_sqliteHelper.execSql("delete from tb_backfilehistory where id=" +
-                                       std::to_string(subret->getColumn("id").getInt()));
+            }
+            // 其他来源的版本仍在引用的备份文件和块保留
+            for (const auto& history : versions)
+            {
+                deleteVersion(history);
             }
             ++counter;
             const auto nowSec = Utils::getMilliTimeStamp() / 1000;
@@ -416,8 +1884,7 @@ void ServiceRun::deleteByBackuprootid(int64_t rootid)
             }
         }
     }
-    m_sqliteHelper.execSql("delete from tb_backfiles where backuprootid=" +
-                           std::to_string(rootid));
+    m_sqliteHelper.exec("delete from tb_backfiles where backuprootid=?", rootid);
 }
 
 void ServiceRun::XCopy()
@@ -436,8 +1903,18 @@ void ServiceRun::XCopy()
         return;
     }
 
+    if (parallelCopy() && !m_backupTargetRootList.empty())
+    {
+        const auto workers = copyWorkers(m_backupTargetRootList.size());
+        m_copyScheduler = std::make_unique<CopyScheduler>(workers, copyPerTarget(), workers * 4);
+        m_uringCopy = uringCopy() && UringCopier::available();
+        logger.info("parallel copy: " + std::to_string(workers) + " workers, " +
+                    std::to_string(copyPerTarget()) + " per target" +
+                    (m_uringCopy ? ", io_uring for small files" : ""));
+    }
     for (const auto& backuproot : m_backupRootList)
     {
+        // 出错中断时 XCopy 在提交最后一批前已写入排队的拷贝
         try
         {
             XCopy(backuproot);
@@ -447,6 +1924,11 @@ void ServiceRun::XCopy()
             logger.error(e.what());
         }
     }
+    m_copyScheduler.reset();
+    // 正常结束时都已处理；中止时未能处理的等待下次备份
+    m_inflightCopies.clear();
+    m_dedupWaiters.clear();
+    m_uringCopy = false;
     finishbackup();
 }
 
@@ -467,34 +1949,31 @@ void ServiceRun::removeWastedData(int64_t backupfilehistoryid,
 {
     try
     {
-        if (auto ret = m_sqliteHelper.prepareQuery(
-                "select backupfileid from tb_backfilehistory where id=" +
-                std::to_string(backupfilehistoryid));
+        timemachine::BackupHistory history;
+        if (auto ret = m_sqliteHelper.query(
+                "select id,backupfileid,backuptargetrootid,backuptargetpath,storage "
+                "from tb_backfilehistory where id=?",
+                backupfilehistoryid);
             ret && ret->executeStep())
         {
-            const auto backupfileid = ret->getColumn("backupfileid").getInt64();
-            m_sqliteHelper.execSql("delete from tb_backfilehistory where id=" +
-                                   std::to_string(backupfilehistoryid));
-
-            const auto u8path = u8path_from(backupfilefullpath);
-            if (std::filesystem::exists(u8path))
-            {
-                logger.info("delete broken file:" + backupfilefullpath);
-                std::filesystem::remove(u8path);
-            }
-            if (auto cntRet = m_sqliteHelper.prepareQuery(
-                    "select count(*) from tb_backfilehistory where "
-                    "backupfileid=" +
-                    std::to_string(backupfileid));
-                cntRet && cntRet->executeStep())
-            {
-                const int historycnt = cntRet->getColumn("count(*)").getInt();
-                if (historycnt == 0)
-                {
-                    m_sqliteHelper.execSql("delete from tb_backfiles where id=" +
-                                           std::to_string(backupfileid));
-                }
-            }
+            history.id = ret->getColumn("id").getInt();
+            history.backupfileid = ret->getColumn("backupfileid").getInt64();
+            history.backuptargetrootid = ret->getColumn("backuptargetrootid").getInt();
+            history.backuptargetpath = ret->getColumn("backuptargetpath").getString();
+            history.storage = ret->getColumn("storage").getString();
+            history.backuptargetfullpath = backupfilefullpath;
+        }
+        const auto backupfileid = history.backupfileid;
+        if (backupfileid != 0)
+        {
+            // 损坏的备份文件或块被其他版本共用时，那些版本同样会被检查出来，最后一个引用释放时删除
+            logger.info("release broken version id=" + std::to_string(history.id) + " (" +
+                        history.storage + "):" + backupfilefullpath);
+            deleteVersion(history);
+            // 最新版本可能正是被删除的这个，重新计算；已没有任何版本的文件记录一并删除
+            m_sqliteHelper.exec(CatalogQueries::refreshCurrentVersion, backupfileid);
+            m_sqliteHelper.exec("delete from tb_backfiles where id=? and versionhistorycnt=0",
+                                backupfileid);
         }
     }
     catch (const std::exception& e)
@@ -509,21 +1988,36 @@ void ServiceRun::checkdata(bool withhash)
     {
         logger.info("loading all file and check");
         int innercounter = 0;
+        int lastId = 0;
         std::vector<timemachine::BackupHistory> historyList;
+        // 每页中 MD5 的文件读完这一页后用多路 MD5 一起计算
+        std::vector<timemachine::BackupHistory> md5List;
+        // 按块保存的版本逐个检查块清单，被多个版本共用的块只检查一次
+        std::vector<timemachine::BackupHistory> chunkedList;
+        std::map<int64_t, bool> checkedObjects;
+        // 追加、差量版本依赖基础版本，基础版本损坏时一并移除
+        std::vector<timemachine::BackupHistory> derivedList;
+        std::set<int64_t> brokenIds;
         auto timestamp = Utils::getMilliTimeStamp() / 1000;
         while (true)
         {
             int counter = 0;
-            if (auto ret = m_sqliteHelper.prepareQuery(
-                    "select * from tb_backfilehistory limit " +
-                    std::to_string(innercounter) + ",1000");
+            md5List.clear();
+            chunkedList.clear();
+            derivedList.clear();
+            // 按主键分页，避免 limit offset 越往后越慢
+            if (auto ret = m_sqliteHelper.query(
+                    "select * from tb_backfilehistory where id>? order by id limit 1000",
+                    lastId);
                 ret)
             {
                 while (ret->executeStep())
                 {
                     timemachine::BackupHistory backupHistory;
                     backupHistory.id = ret->getColumn("id").getInt();
+                    lastId = backupHistory.id;
                     backupHistory.md5 = ret->getColumn("md5").getString();
+                    backupHistory.hashalgo = ret->getColumn("hashalgo").getString();
                     backupHistory.filesize = ret->getColumn("filesize").getInt64();
                     backupHistory.backupfileid =
                         ret->getColumn("backupfileid").getInt64();
@@ -531,6 +2025,8 @@ void ServiceRun::checkdata(bool withhash)
                         ret->getColumn("backuptargetrootid").getInt();
                     backupHistory.backuptargetpath =
                         ret->getColumn("backuptargetpath").getString();
+                    backupHistory.storage = ret->getColumn("storage").getString();
+                    backupHistory.basehistoryid = ret->getColumn("basehistoryid").getInt64();
 
                     const std::string backuprootpath =
                         getTargetrootPath(backupHistory.backuptargetrootid) +
@@ -538,15 +2034,34 @@ void ServiceRun::checkdata(bool withhash)
                     backupHistory.backuptargetfullpath = backuprootpath;
 
                     const auto u8path = u8path_from(backuprootpath);
-                    if (!std::filesystem::exists(u8path) ||
+                    if (backupHistory.storage == "chunks")
+                    {
+                        chunkedList.emplace_back(backupHistory);
+                    }
+                    else if (backupHistory.storage == "append" ||
+                             backupHistory.storage == "delta")
+                    {
+                        derivedList.emplace_back(backupHistory);
+                    }
+                    else if (!std::filesystem::exists(u8path) ||
                         std::filesystem::file_size(u8path) !=
                             static_cast<std::uintmax_t>(backupHistory.filesize))
                     {
                         historyList.emplace_back(backupHistory);
                     }
+                    else if (withhash && !Digest::isSupported(backupHistory.hashalgo))
+                    {
+                        logger.error("unsupported hash algorithm " + backupHistory.hashalgo +
+                                     ", skip: " + backuprootpath);
+                    }
+                    else if (withhash && backupHistory.hashalgo == "md5")
+                    {
+                        md5List.emplace_back(backupHistory);
+                    }
                     else if (withhash)
                     {
-                        const std::string md5str = Utils::getFileMD5(backuprootpath);
+                        const std::string md5str =
+                            Utils::getFileDigest(backuprootpath, backupHistory.hashalgo);
                         if (backupHistory.md5 != md5str)
                         {
                             logger.info("file hash not mismatch:" + backuprootpath);
@@ -564,6 +2079,49 @@ void ServiceRun::checkdata(bool withhash)
                     }
                 }
             }
+            if (!md5List.empty())
+            {
+                std::vector<std::string> paths;
+                paths.reserve(md5List.size());
+                for (const auto& backupHistory : md5List)
+                {
+                    paths.push_back(backupHistory.backuptargetfullpath);
+                }
+                const auto digests = Md5Multi::hashFiles(paths);
+                for (std::size_t i = 0; i < md5List.size(); ++i)
+                {
+                    if (md5List[i].md5 != digests[i])
+                    {
+                        logger.info("file hash not mismatch:" + paths[i]);
+                        historyList.emplace_back(md5List[i]);
+                    }
+                }
+            }
+            for (const auto& backupHistory : chunkedList)
+            {
+                if (!verifyManifest(backupHistory, withhash, checkedObjects))
+                {
+                    logger.info("chunked version broken: id=" +
+                                std::to_string(backupHistory.id));
+                    historyList.emplace_back(backupHistory);
+                }
+            }
+            // 基础版本的 id 更小，在本页前面的部分或之前的页中已经检查过
+            for (const auto& backupHistory : historyList)
+            {
+                brokenIds.insert(backupHistory.id);
+            }
+            for (const auto& backupHistory : derivedList)
+            {
+                if (!verifyDerived(backupHistory, withhash, brokenIds))
+                {
+                    logger.info(backupHistory.storage + " version broken: id=" +
+                                std::to_string(backupHistory.id) +
+                                " base:" + std::to_string(backupHistory.basehistoryid));
+                    historyList.emplace_back(backupHistory);
+                    brokenIds.insert(backupHistory.id);
+                }
+            }
             if (counter == 0)
             {
                 break;
@@ -573,9 +2131,11 @@ void ServiceRun::checkdata(bool withhash)
 
         innercounter = 0;
         logger.info("begin removing wasted backup file records");
+        TransactionBatch batch(m_sqliteHelper, batchRows(), batchMillis());
         for (const auto& backupHistory : historyList)
         {
             ++innercounter;
+            batch.add();
             removeWastedData(backupHistory.id, backupHistory.backuptargetfullpath);
             const auto nowSec = Utils::getMilliTimeStamp() / 1000;
             if (nowSec != timestamp)
@@ -594,6 +2154,132 @@ void ServiceRun::checkdata(bool withhash)
     }
 }
 
+bool ServiceRun::verifyManifest(const timemachine::BackupHistory& history, bool withhash,
+                                std::map<int64_t, bool>& checked)
+{
+    struct Chunk
+    {
+        int64_t id;
+        std::string path;
+        std::string hashalgo;
+        std::string digest;
+    };
+    std::vector<int64_t> ids;
+    std::vector<Chunk> toHash;
+    int64_t total = 0;
+    if (auto ret = m_sqliteHelper.query(CatalogQueries::manifestByHistory, history.id); ret)
+    {
+        while (ret->executeStep())
+        {
+            const auto chunksize = ret->getColumn("chunksize").getInt64();
+            const auto id = ret->getColumn("objectid").getInt64();
+            total += chunksize;
+            ids.push_back(id);
+            if (checked.count(id) != 0)
+            {
+                continue;
+            }
+            Chunk chunk{id,
+                        getTargetrootPath(ret->getColumn("backuptargetrootid").getInt()) +
+                            ret->getColumn("backuptargetpath").getString(),
+                        ret->getColumn("hashalgo").getString(),
+                        ret->getColumn("digest").getString()};
+            std::error_code ec;
+            const auto size = std::filesystem::file_size(u8path_from(chunk.path), ec);
+            const bool ok = !ec && chunksize == ret->getColumn("filesize").getInt64() &&
+                            size == static_cast<std::uintmax_t>(chunksize);
+            if (!ok)
+            {
+                logger.info("chunk missing or size mismatch:" + chunk.path);
+            }
+            checked[id] = ok;
+            if (ok && withhash)
+            {
+                toHash.push_back(std::move(chunk));
+            }
+        }
+    }
+
+    // MD5 的块用多路 MD5 一起计算
+    std::vector<std::string> md5Paths;
+    std::vector<const Chunk*> md5Chunks;
+    for (const auto& chunk : toHash)
+    {
+        if (chunk.hashalgo == "md5")
+        {
+            md5Paths.push_back(chunk.path);
+            md5Chunks.push_back(&chunk);
+        }
+        else if (!Digest::isSupported(chunk.hashalgo))
+        {
+            logger.error("unsupported hash algorithm " + chunk.hashalgo + ", skip: " + chunk.path);
+        }
+        else if (Utils::getFileDigest(chunk.path, chunk.hashalgo) != chunk.digest)
+        {
+            logger.info("chunk hash mismatch:" + chunk.path);
+            checked[chunk.id] = false;
+        }
+    }
+    const auto digests = Md5Multi::hashFiles(md5Paths);
+    for (std::size_t i = 0; i < md5Chunks.size(); ++i)
+    {
+        if (digests[i] != md5Chunks[i]->digest)
+        {
+            logger.info("chunk hash mismatch:" + md5Paths[i]);
+            checked[md5Chunks[i]->id] = false;
+        }
+    }
+
+    bool ok = total == history.filesize;
+    for (const auto id : ids)
+    {
+        ok = ok && checked[id];
+    }
+    return ok;
+}
+
+bool ServiceRun::verifyDerived(const timemachine::BackupHistory& history, bool withhash,
+                               const std::set<int64_t>& broken)
+{
+    if (broken.count(history.basehistoryid) != 0)
+    {
+        return false;
+    }
+    if (auto ret = m_sqliteHelper.query(CatalogQueries::versionStorage, history.basehistoryid);
+        !ret || !ret->executeStep())
+    {
+        logger.info("base version missing: " + std::to_string(history.basehistoryid));
+        return false;
+    }
+    bool found = false;
+    int64_t size = 0;
+    std::string hashalgo;
+    std::string digest;
+    if (auto ret = m_sqliteHelper.query(CatalogQueries::objectByPath, history.backuptargetrootid,
+                                        history.backuptargetpath);
+        ret && ret->executeStep())
+    {
+        found = true;
+        size = ret->getColumn("filesize").getInt64();
+        hashalgo = ret->getColumn("hashalgo").getString();
+        digest = ret->getColumn("digest").getString();
+    }
+    const auto& path = history.backuptargetfullpath;
+    std::error_code ec;
+    const auto actual = std::filesystem::file_size(u8path_from(path), ec);
+    if (!found || ec || actual != static_cast<std::uintmax_t>(size))
+    {
+        logger.info(history.storage + " data missing or size mismatch:" + path);
+        return false;
+    }
+    if (withhash && Digest::isSupported(hashalgo) && Utils::getFileDigest(path, hashalgo) != digest)
+    {
+        logger.info("file hash not mismatch:" + path);
+        return false;
+    }
+    return true;
+}
+
 void ServiceRun::listBackupPaths()
 {
     logger.info("Source Backup Paths:");
@@ -665,6 +2351,190 @@ bool ServiceRun::removeSourcePath(const std::string& source)
     return false;
 }
 
+bool ServiceRun::reshardTargets()
+{
+    bool ok = true;
+    for (const auto& target : m_backupTargetRootList)
+    {
+        try
+        {
+            ok = reshardTarget(target) && ok;
+        }
+        catch (const std::exception& e)
+        {
+            logger.error("reshard " + target.targetrootpath + " failed: " + e.what());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool ServiceRun::reshardTarget(const timemachine::Backuptargetroot& target)
+{
+    logger.info("reshard target " + target.targetrootpath);
+    const auto prefix = "/" + target.targetrootdir + "/";
+    struct Move
+    {
+        int64_t id;
+        std::string from;  // 原 backuptargetpath
+        std::string to;
+        bool linked;  // 用硬链接建立新路径，提交后删除原路径；否则已经改名
+    };
+    int64_t lastId = 0;
+    int64_t moved = 0;
+    int64_t missing = 0;
+    bool ok = true;
+    constexpr int64_t pageSize = 1000;
+    while (true)
+    {
+        std::vector<std::pair<int64_t, std::string>> page;
+        if (auto ret = m_sqliteHelper.query(CatalogQueries::objectsByTarget, target.id, lastId,
+                                            pageSize);
+            ret)
+        {
+            while (ret->executeStep())
+            {
+                page.emplace_back(ret->getColumn("id").getInt64(),
+                                  ret->getColumn("backuptargetpath").getString());
+            }
+        }
+        if (page.empty())
+        {
+            break;
+        }
+        lastId = page.back().first;
+
+        // 先在新位置建立文件（能硬链接时新旧路径同时有效），再在一个事务中修改本批路径，
+        // 提交后删除原路径；任何时刻数据库中的路径都指向存在的文件
+        std::vector<Move> moves;
+        for (const auto& [id, path] : page)
+        {
+            // 块文件及已分层的对象不在目标目录的第一层
+            if (path.compare(0, prefix.size(), prefix) != 0 ||
+                path.find('/', prefix.size()) != std::string::npos)
+            {
+                continue;
+            }
+            const auto to = objectPath(target.targetrootdir, path.substr(prefix.size()), true);
+            if (to == path)
+            {
+                continue;
+            }
+            const auto fromFull = u8path_from(target.targetrootpath + path);
+            const auto toFull = u8path_from(target.targetrootpath + to);
+            std::error_code ec;
+            std::filesystem::create_directories(toFull.parent_path(), ec);
+            bool linked = true;
+            if (std::filesystem::exists(toFull, ec))
+            {
+                // 上次中断前已建立的链接
+                if (std::filesystem::exists(fromFull, ec) &&
+                    !std::filesystem::equivalent(fromFull, toFull, ec))
+                {
+                    logger.error("reshard conflict, keeping " + fromFull.u8string() + ": " +
+                                 toFull.u8string() + " is a different file");
+                    ok = false;
+                    continue;
+                }
+            }
+            else if (!std::filesystem::exists(fromFull, ec))
+            {
+                logger.error("reshard: backup file not found: " + fromFull.u8string());
+                ++missing;
+                continue;
+            }
+            else
+            {
+                std::filesystem::create_hard_link(fromFull, toFull, ec);
+                if (ec)
+                {
+                    // 不支持硬链接的文件系统（FAT 等）直接改名，提交前该对象短暂只在新路径
+                    linked = false;
+                    std::filesystem::rename(fromFull, toFull, ec);
+                    if (ec)
+                    {
+                        logger.error("reshard: cannot move " + fromFull.u8string() + ": " +
+                                     ec.message());
+                        ok = false;
+                        continue;
+                    }
+                }
+            }
+            moves.push_back({id, path, to, linked});
+        }
+        if (moves.empty())
+        {
+            continue;
+        }
+
+        m_sqliteHelper.beginTransaction();
+        try
+        {
+            for (const auto& move : moves)
+            {
+                m_sqliteHelper.exec(CatalogQueries::moveObject, move.to, move.id);
+                m_sqliteHelper.exec(CatalogQueries::moveObjectVersions, move.to, target.id,
+                                    move.from);
+            }
+            m_sqliteHelper.commitTransaction();
+        }
+        catch (const std::exception&)
+        {
+            m_sqliteHelper.rollbackTransaction();
+            // 撤销本批文件操作，数据库中仍是原路径
+            for (const auto& move : moves)
+            {
+                std::error_code ec;
+                const auto fromFull = u8path_from(target.targetrootpath + move.from);
+                const auto toFull = u8path_from(target.targetrootpath + move.to);
+                if (move.linked)
+                {
+                    std::filesystem::remove(toFull, ec);
+                }
+                else
+                {
+                    std::filesystem::rename(toFull, fromFull, ec);
+                }
+            }
+            throw;
+        }
+        for (const auto& move : moves)
+        {
+            std::error_code ec;
+            std::filesystem::remove(u8path_from(target.targetrootpath + move.from), ec);
+        }
+        moved += static_cast<int64_t>(moves.size());
+        logger.info("resharded " + std::to_string(moved) + " backup files");
+    }
+
+    // 上次在提交后、删除原路径前中断时，目标目录下还留有指向同一文件的原路径
+    int64_t leftovers = 0;
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(u8path_from(target.targetrootpath + prefix), ec),
+         end;
+         !ec && it != end; it.increment(ec))
+    {
+        const auto name = it->path().filename().u8string();
+        if (name.empty() || name.front() == '_' || !it->is_regular_file(ec))
+        {
+            continue;
+        }
+        const auto sharded =
+            u8path_from(target.targetrootpath + objectPath(target.targetrootdir, name, true));
+        std::error_code linkEc;
+        if (sharded != it->path() && std::filesystem::equivalent(it->path(), sharded, linkEc) &&
+            std::filesystem::remove(it->path(), linkEc))
+        {
+            ++leftovers;
+        }
+    }
+
+    logger.info("reshard " + target.targetrootpath + " finished, moved:" + std::to_string(moved) +
+                " missing:" + std::to_string(missing) +
+                " leftovers removed:" + std::to_string(leftovers));
+    return ok;
+}
+
 bool ServiceRun::removeTargetPath(const std::string& target)
 {
     if (auto ret = m_sqliteHelper.prepareQuery(
@@ -685,31 +2555,26 @@ bool ServiceRun::restoreFile(const std::string& filePath)
 {
     auto path = std::filesystem::path(filePath);
     const auto originFileName = path.filename();
-    auto safeFilePath = Utils::replace(path.u8string(), "\\", "\\\\");
-    const std::string sql =
-        "select * from tb_backfilehistory, tb_backfiles, "
-        "tb_backuptargetroot "
-        "where tb_backfilehistory.backupfileid = tb_backfiles.id "
-        "and tb_backfilehistory.backuptargetrootid = "
-        "tb_backuptargetroot.id "
-        "and tb_backfiles.filepath = :value";
-    if (auto ret = m_sqliteHelper.prepareQuery(sql); ret)
-    {
-        ret->bind(":value", safeFilePath);
-        std::vector<std::filesystem::path> allPath;
-        allPath.reserve(8);
+    if (auto ret = m_sqliteHelper.query(CatalogQueries::restoreVersions, path.u8string()); ret)
+    {
+        std::vector<timemachine::BackupHistory> versions;
+        versions.reserve(8);
         int cnt = 0;
         while (ret->executeStep())
         {
-            const auto targetPath = ret->getColumn("targetrootpath").getString();
-            const auto fullBackupPath =
-                u8path_from(targetPath + ret->getColumn("backuptargetpath").getString());
-            const auto modifyTime =
-                static_cast<time_t>(ret->getColumn("motifytime").getInt64());
+            timemachine::BackupHistory version;
+            version.id = ret->getColumn("id").getInt();
+            version.motifytime = ret->getColumn("motifytime").getInt64();
+            version.filesize = ret->getColumn("filesize").getInt64();
+            version.md5 = ret->getColumn("md5").getString();
+            version.hashalgo = ret->getColumn("hashalgo").getString();
+            version.storage = ret->getColumn("storage").getString();
+            version.backuptargetfullpath = ret->getColumn("targetrootpath").getString() +
+                                           ret->getColumn("backuptargetpath").getString();
 
-            allPath.emplace_back(fullBackupPath);
-            logger.info("[" + std::to_string(++cnt) +
-                        "]: " + Utils::Date::getDateFromMillis(modifyTime));
+            logger.info("[" + std::to_string(++cnt) + "]: " +
+                        Utils::Date::getDateFromMillis(static_cast<time_t>(version.motifytime)));
+            versions.push_back(std::move(version));
         }
         if (cnt)
         {
@@ -717,10 +2582,19 @@ bool ServiceRun::restoreFile(const std::string& filePath)
             logger.info("若要恢复指定时间的版本，请输入对应时间的编号");
             std::cin >> n;
             --n;
-            if (n >= 0 && n < static_cast<int>(allPath.size()) &&
-                std::filesystem::exists(allPath.at(n)))
+            if (n >= 0 && n < static_cast<int>(versions.size()) &&
+                versions.at(n).storage != "file")
+            {
+                if (restoreAssembled(versions.at(n), path.replace_filename(originFileName)))
+                {
+                    logger.info("restore file success: " + filePath);
+                    return true;
+                }
+            }
+            else if (n >= 0 && n < static_cast<int>(versions.size()) &&
+                     std::filesystem::exists(u8path_from(versions.at(n).backuptargetfullpath)))
             {
-                std::filesystem::copy(allPath.at(n),
+                std::filesystem::copy(u8path_from(versions.at(n).backuptargetfullpath),
                                       path.replace_filename(originFileName),
                                       std::filesystem::copy_options::overwrite_existing);
                 logger.info("restore file success: " + filePath);
@@ -734,3 +2608,257 @@ bool ServiceRun::restoreFile(const std::string& filePath)
     }
     return false;
 }
+
+bool ServiceRun::restoreAssembled(const timemachine::BackupHistory& history,
+                                  const std::filesystem::path& dest)
+{
+    auto temp = dest;
+    temp += ".part";
+    try
+    {
+        const auto digest = Digest::create(history.hashalgo);
+        std::ofstream out(temp, std::ofstream::binary | std::ofstream::trunc);
+        if (!out)
+        {
+            throw std::runtime_error("cannot create file: " + temp.u8string());
+        }
+        const auto total = writeVersionContent(history.id, out, *digest, dest.parent_path());
+        out.close();
+        if (!out)
+        {
+            throw std::runtime_error("failed to write file: " + temp.u8string());
+        }
+        // 块、追加部分或补丁损坏、缺失时不覆盖原文件
+        if (total != history.filesize || digest->hexFinal() != history.md5)
+        {
+            throw std::runtime_error("restored content does not match the recorded digest");
+        }
+        std::filesystem::rename(temp, dest);
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        logger.error("failed to restore version id=" + std::to_string(history.id) + ": " +
+                     e.what());
+        std::error_code ec;
+        std::filesystem::remove(temp, ec);
+        return false;
+    }
+}
+
+int64_t ServiceRun::writeVersionContent(int64_t historyid, std::ostream& out, Digest& digest,
+                                        const std::filesystem::path& scratchDir)
+{
+    // 沿 basehistoryid 找到完整版本，再从它开始依次拼接追加部分、应用补丁
+    struct Part
+    {
+        int64_t id;
+        std::string storage;
+        std::string path;
+    };
+    std::vector<Part> chain;
+    for (auto id = historyid;;)
+    {
+        int64_t base = 0;
+        bool found = false;
+        if (auto ret = m_sqliteHelper.query(CatalogQueries::versionStorage, id);
+            ret && ret->executeStep())
+        {
+            chain.push_back({id, ret->getColumn("storage").getString(),
+                             getTargetrootPath(ret->getColumn("backuptargetrootid").getInt()) +
+                                 ret->getColumn("backuptargetpath").getString()});
+            base = ret->getColumn("basehistoryid").getInt64();
+            found = true;
+        }
+        if (!found)
+        {
+            throw std::runtime_error("missing version id=" + std::to_string(id));
+        }
+        if (chain.back().storage != "append" && chain.back().storage != "delta")
+        {
+            break;
+        }
+        // 基础版本总是更早写入，id 更小
+        if (base <= 0 || base >= id)
+        {
+            throw std::runtime_error("invalid base of version id=" + std::to_string(id));
+        }
+        id = base;
+    }
+    std::reverse(chain.begin(), chain.end());
+
+    std::vector<char> buffer(1 << 20);
+    int64_t total = 0;
+    // 把文件的 size 字节（-1 表示全部）交给 sink
+    auto copyPart = [&](const std::string& path, int64_t size, const Delta::Sink& sink)
+    {
+        std::ifstream in(u8path_from(path), std::ifstream::binary);
+        if (!in)
+        {
+            throw std::runtime_error("cannot open backup file: " + path);
+        }
+        int64_t copied = 0;
+        while (size < 0 || copied < size)
+        {
+            auto want = static_cast<std::streamsize>(buffer.size());
+            if (size >= 0)
+            {
+                want = static_cast<std::streamsize>(
+                    std::min<int64_t>(want, size - copied));
+            }
+            in.read(buffer.data(), want);
+            const auto count = in.gcount();
+            if (count <= 0)
+            {
+                break;
+            }
+            sink(buffer.data(), static_cast<std::size_t>(count));
+            copied += count;
+        }
+        if (in.bad() || (size >= 0 && copied != size))
+        {
+            throw std::runtime_error("backup file missing or truncated: " + path);
+        }
+    };
+    // 链首的完整版本：单个备份文件或按块清单拼接
+    auto copyFull = [&](const Part& part, const Delta::Sink& sink)
+    {
+        if (part.storage != "chunks")
+        {
+            copyPart(part.path, -1, sink);
+            return;
+        }
+        std::vector<std::pair<std::string, int64_t>> chunks;
+        if (auto ret = m_sqliteHelper.query(CatalogQueries::manifestByHistory, part.id); ret)
+        {
+            while (ret->executeStep())
+            {
+                chunks.emplace_back(
+                    getTargetrootPath(ret->getColumn("backuptargetrootid").getInt()) +
+                        ret->getColumn("backuptargetpath").getString(),
+                    ret->getColumn("chunksize").getInt64());
+            }
+        }
+        for (const auto& [path, size] : chunks)
+        {
+            copyPart(path, size, sink);
+        }
+    };
+    const Delta::Sink toOut = [&](const void* data, std::size_t size)
+    {
+        digest.update(data, size);
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        total += static_cast<int64_t>(size);
+    };
+
+    std::size_t lastDelta = 0;
+    for (std::size_t i = 1; i < chain.size(); ++i)
+    {
+        if (chain[i].storage == "delta")
+        {
+            lastDelta = i;
+        }
+    }
+    if (lastDelta == 0)
+    {
+        copyFull(chain.front(), toOut);
+        for (std::size_t i = 1; i < chain.size(); ++i)
+        {
+            copyPart(chain[i].path, -1, toOut);
+        }
+        return total;
+    }
+
+    // 应用补丁需要随机读取前一个版本：最后一个差量版本及之前的内容依次还原到临时文件，
+    // 每一步只保留最近的一个，之后的追加部分直接输出
+    std::filesystem::path temp;
+    std::vector<std::filesystem::path> temps;
+    auto removeTemps = [&]()
+    {
+        for (const auto& path : temps)
+        {
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+        temps.clear();
+    };
+    auto writeTemp = [&](const std::function<void(const Delta::Sink&)>& produce,
+                         std::ios::openmode mode)
+    {
+        std::ofstream file(temp, std::ofstream::binary | mode);
+        if (!file)
+        {
+            throw std::runtime_error("cannot create file: " + temp.u8string());
+        }
+        produce([&](const void* data, std::size_t size)
+                { file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size)); });
+        file.close();
+        if (!file)
+        {
+            throw std::runtime_error("failed to write file: " + temp.u8string());
+        }
+    };
+    const auto timestamp = uniqueTimestamp();
+    auto nextTemp = [&]()
+    {
+        temps.push_back(scratchDir / ("_restore_" + std::to_string(historyid) + "_" + timestamp +
+                                      "_" + std::to_string(temps.size()) + ".part"));
+        return temps.back();
+    };
+    try
+    {
+        std::string basis = chain.front().path;
+        if (chain.front().storage == "chunks")
+        {
+            temp = nextTemp();
+            writeTemp([&](const Delta::Sink& sink) { copyFull(chain.front(), sink); },
+                      std::ios::trunc);
+            basis = temp.u8string();
+        }
+        for (std::size_t i = 1; i <= lastDelta; ++i)
+        {
+            const auto& part = chain[i];
+            if (part.storage == "append")
+            {
+                // 临时文件可以直接追加，备份文件本身需要先复制一份
+                if (temp.empty())
+                {
+                    temp = nextTemp();
+                    writeTemp([&](const Delta::Sink& sink) { copyPart(basis, -1, sink); },
+                              std::ios::trunc);
+                    basis = temp.u8string();
+                }
+                writeTemp([&](const Delta::Sink& sink) { copyPart(part.path, -1, sink); },
+                          std::ios::app);
+                continue;
+            }
+            std::ifstream patch(u8path_from(part.path), std::ifstream::binary);
+            if (!patch)
+            {
+                throw std::runtime_error("cannot open backup file: " + part.path);
+            }
+            const auto previous = temp;
+            temp = nextTemp();
+            writeTemp([&](const Delta::Sink& sink) { Delta::apply(patch, basis, sink); },
+                      std::ios::trunc);
+            if (!previous.empty())
+            {
+                std::error_code ec;
+                std::filesystem::remove(previous, ec);
+            }
+            basis = temp.u8string();
+        }
+        copyPart(basis, -1, toOut);
+        for (std::size_t i = lastDelta + 1; i < chain.size(); ++i)
+        {
+            copyPart(chain[i].path, -1, toOut);
+        }
+    }
+    catch (const std::exception&)
+    {
+        removeTemps();
+        throw;
+    }
+    removeTemps();
+    return total;
+}
@@ -1,6 +1,89 @@
 #include "sqlite_helper.h"
 
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// 拼进 pragma 语句的取值只允许字母，避免配置文件中的内容被当作 SQL 执行
+bool isPragmaWord(const std::string& value)
+{
+    return !value.empty() && std::all_of(value.begin(), value.end(), [](unsigned char c) {
+        return std::isalpha(c) != 0;
+    });
+}
+
+// 执行 pragma 并返回第一行第一列
+std::string pragmaValue(SQLite::Database& db, const std::string& sql)
+{
+    SQLite::Statement stmt(db, sql);
+    return stmt.executeStep() ? stmt.getColumn(0).getString() : std::string();
+}
+
+// synchronous、temp_store 读回的是编号，转成名称用于日志
+std::string pragmaName(SQLite::Database& db, const std::string& sql,
+                       const std::vector<std::string>& names)
+{
+    const auto value = pragmaValue(db, sql);
+    const auto index = value.empty() ? names.size() : static_cast<std::size_t>(std::stoi(value));
+    return index < names.size() ? names[index] : value;
+}
+}  // namespace
+
+// 后台 checkpoint：用独立连接定期执行 PASSIVE checkpoint，把 WAL 中已提交的页写回数据库文件。
+// 写连接关闭了自动 checkpoint，提交时不会被 checkpoint 拖慢；PASSIVE 不等待读者，也不阻塞写者
+class WalCheckpointer
+{
+public:
+    WalCheckpointer(const std::string& dbname, std::chrono::milliseconds interval)
+        : m_dataBase(dbname, SQLite::OPEN_READWRITE), m_interval(interval)
+    {
+        // 新连接要先读一次数据库才会打开 WAL，否则 checkpoint 什么也不做
+        pragmaValue(m_dataBase, "pragma journal_mode");
+        m_thread = std::thread([this] { run(); });
+    }
+
+    ~WalCheckpointer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_cv.wait_for(lock, m_interval, [this] { return m_stop; }))
+        {
+            lock.unlock();
+            const int rc = sqlite3_wal_checkpoint_v2(m_dataBase.getHandle(), nullptr,
+                                                     SQLITE_CHECKPOINT_PASSIVE, nullptr, nullptr);
+            if (rc != SQLITE_OK && rc != SQLITE_BUSY)
+            {
+                std::cerr << "WalCheckpointer: checkpoint failed: " << sqlite3_errstr(rc) << "\n";
+            }
+            lock.lock();
+        }
+    }
+
+    SQLite::Database m_dataBase;
+    std::chrono::milliseconds m_interval;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop = false;
+    std::thread m_thread;
+};
 
 SQLiteHelper::SQLiteHelper(const std::string& dbname)
     : m_dbname(dbname), m_dataBase(nullptr)
@@ -68,9 +151,152 @@ std::unique_ptr<SQLite::Statement> SQLiteHelper::prepareQuery(
     }
 }
 
+SQLite::Statement* SQLiteHelper::cachedStatement(const std::string& sql)
+{
+    if (!valid())
+    {
+        return nullptr;
+    }
+
+    auto it = m_statements.find(sql);
+    if (it == m_statements.end())
+    {
+        try
+        {
+            it = m_statements
+                     .emplace(sql, std::make_unique<SQLite::Statement>(*m_dataBase, sql))
+                     .first;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "SQLiteHelper::query error: " << e.what() << " SQL:[" << sql
+                      << "]\n";
+            return nullptr;
+        }
+    }
+    // 上一次使用者可能没有读完结果
+    it->second->reset();
+    it->second->clearBindings();
+    return it->second.get();
+}
+
+int64_t SQLiteHelper::lastInsertRowid() const noexcept
+{
+    return valid() ? m_dataBase->getLastInsertRowid() : 0;
+}
+
+std::string SQLiteHelper::applyProfile(const SQLiteProfile& profile)
+{
+    if (!valid())
+    {
+        return profile.name + ": database not open";
+    }
+
+    m_checkpointer.reset();
+    m_dataBase->setBusyTimeout(static_cast<int>(profile.busyTimeoutMs));
+
+    std::string journalMode = "unchanged";
+    if (isPragmaWord(profile.journalMode))
+    {
+        // 切换到 WAL 需要独占数据库；失败时沿用原模式继续运行
+        try
+        {
+            journalMode = pragmaValue(*m_dataBase, "pragma journal_mode=" + profile.journalMode);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "SQLiteHelper::applyProfile journal_mode error: " << e.what() << "\n";
+            journalMode = pragmaValue(*m_dataBase, "pragma journal_mode");
+        }
+    }
+    if (isPragmaWord(profile.synchronous))
+    {
+        execSql("pragma synchronous=" + profile.synchronous);
+    }
+    if (isPragmaWord(profile.tempStore))
+    {
+        execSql("pragma temp_store=" + profile.tempStore);
+    }
+    // cache_size 取负值表示以 KiB 为单位
+    execSql("pragma cache_size=-" + std::to_string(profile.cacheSizeKb));
+    const auto mmapSize =
+        std::stoll(pragmaValue(*m_dataBase, "pragma mmap_size=" + std::to_string(profile.mmapSize)));
+
+    std::string checkpoint = "auto";
+    if (journalMode == "wal" && profile.checkpointMillis > 0)
+    {
+        execSql("pragma wal_autocheckpoint=0");
+        m_checkpointer = std::make_unique<WalCheckpointer>(
+            m_dbname, std::chrono::milliseconds(profile.checkpointMillis));
+        checkpoint = "background " + std::to_string(profile.checkpointMillis) + "ms";
+    }
+    else
+    {
+        execSql("pragma wal_autocheckpoint=1000");
+    }
+
+    const auto synchronous =
+        pragmaName(*m_dataBase, "pragma synchronous", {"off", "normal", "full", "extra"});
+    const auto tempStore =
+        pragmaName(*m_dataBase, "pragma temp_store", {"default", "file", "memory"});
+    return profile.name + ": journal_mode=" + journalMode + " synchronous=" + synchronous +
+           " cache=" + std::to_string(profile.cacheSizeKb / 1024) + "MB" +
+           " mmap=" + std::to_string(mmapSize / (1024 * 1024)) + "MB" +
+           " temp_store=" + tempStore + " checkpoint=" + checkpoint;
+}
+
+CachedStatement::~CachedStatement()
+{
+    if (m_stmt != nullptr)
+    {
+        try
+        {
+            m_stmt->reset();
+        }
+        catch (...)
+        {
+            // reset 只会重复上一次 step 的错误，此处忽略
+        }
+    }
+}
+
+void SQLiteHelper::beginTransaction()
+{
+    execSql("begin");
+}
+
+void SQLiteHelper::commitTransaction()
+{
+    execSql("commit");
+}
+
+void SQLiteHelper::rollbackTransaction() noexcept
+{
+    if (!inTransaction())
+    {
+        return;
+    }
+    try
+    {
+        m_dataBase->exec("rollback");
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "SQLiteHelper::rollbackTransaction error: " << e.what() << "\n";
+    }
+}
+
+bool SQLiteHelper::inTransaction() const noexcept
+{
+    return valid() && sqlite3_get_autocommit(m_dataBase->getHandle()) == 0;
+}
+
 void SQLiteHelper::close() noexcept
 {
     // 释放数据库对象，触发 SQLite 关闭
+    // checkpoint 连接和语句必须先于数据库连接释放；最后一个连接关闭时 SQLite 会把 WAL 写回数据库
+    m_checkpointer.reset();
+    m_statements.clear();
     if (m_dataBase)
     {
         try
@@ -83,3 +309,59 @@ void SQLiteHelper::close() noexcept
         }
     }
 }
+
+TransactionBatch::TransactionBatch(SQLiteHelper& helper, std::size_t maxRows,
+                                   int64_t maxMillis, std::function<void()> beforeCommit)
+    : m_helper(helper),
+      m_maxRows(maxRows),
+      m_maxDuration(maxMillis),
+      m_beforeCommit(std::move(beforeCommit)),
+      m_begin(std::chrono::steady_clock::now())
+{
+    m_helper.beginTransaction();
+}
+
+TransactionBatch::~TransactionBatch()
+{
+    try
+    {
+        commit();
+    }
+    catch (const std::exception& e)
+    {
+        // 析构中不能抛出：提交失败则回滚本批，下次备份会重新处理这些文件
+        std::cerr << "TransactionBatch: commit failed, rolling back: " << e.what() << "\n";
+        m_helper.rollbackTransaction();
+    }
+}
+
+void TransactionBatch::add(std::size_t rows)
+{
+    m_rows += rows;
+    if (m_rows >= m_maxRows ||
+        std::chrono::steady_clock::now() - m_begin >= m_maxDuration)
+    {
+        flush();
+    }
+}
+
+void TransactionBatch::flush()
+{
+    commit();
+    m_helper.beginTransaction();
+}
+
+void TransactionBatch::commit()
+{
+    if (!m_helper.inTransaction())
+    {
+        return;
+    }
+    if (m_beforeCommit)
+    {
+        m_beforeCommit();
+    }
+    m_helper.commitTransaction();
+    m_rows = 0;
+    m_begin = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,471 @@
+#include "uring_copy.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "hasher.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+int uringSetup(unsigned entries, io_uring_params* params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int uringEnter(int fd, unsigned submit, unsigned wait, unsigned flags)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0));
+}
+
+int uringRegister(int fd, unsigned opcode, void* arg, unsigned count)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+// 每个文件当前进行到的一步，同一文件同时只有一个请求在内核中
+enum class Step
+{
+    OpenSource,
+    OpenTarget,
+    Read,
+    Write,
+    Fsync,
+    CloseTarget,
+    CloseSource
+};
+
+struct Slot
+{
+    std::size_t item = 0;
+    Step step = Step::OpenSource;
+    int source = -1;
+    int target = -1;
+    uint64_t offset = 0;
+    std::size_t length = 0;   // 本块读到的字节数
+    std::size_t written = 0;  // 本块已写出的字节数
+    bool failed = false;
+    std::vector<char> buffer;
+};
+}  // namespace
+
+struct UringCopier::Ring
+{
+    int fd = -1;
+    unsigned entries = 0;
+    void* sqRing = MAP_FAILED;
+    std::size_t sqRingSize = 0;
+    void* cqRing = MAP_FAILED;
+    std::size_t cqRingSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    std::size_t sqesSize = 0;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned pending = 0;  // 已放入提交队列、尚未交给内核的请求
+
+    explicit Ring(unsigned depth)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd = uringSetup(depth, &params);
+        if (fd < 0)
+        {
+            throw std::runtime_error(std::string("io_uring_setup failed: ") + std::strerror(errno));
+        }
+        entries = params.sq_entries;
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        // 5.4 起提交、完成两个环可以一次映射
+        const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+        {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        sqRing = ::mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                        IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED)
+        {
+            release();
+            throw std::runtime_error("failed to map io_uring submission ring");
+        }
+        cqRing = single ? sqRing
+                        : ::mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqeMap = ::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                              fd, IORING_OFF_SQES);
+        if (cqRing == MAP_FAILED || sqeMap == MAP_FAILED)
+        {
+            if (sqeMap != MAP_FAILED)
+            {
+                ::munmap(sqeMap, sqesSize);
+            }
+            release();
+            throw std::runtime_error("failed to map io_uring rings");
+        }
+        sqes = static_cast<io_uring_sqe*>(sqeMap);
+        auto* sq = static_cast<char*>(sqRing);
+        auto* cq = static_cast<char*>(cqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    ~Ring() { release(); }
+
+    void release() noexcept
+    {
+        if (sqes != nullptr)
+        {
+            ::munmap(sqes, sqesSize);
+            sqes = nullptr;
+        }
+        if (cqRing != MAP_FAILED && cqRing != sqRing)
+        {
+            ::munmap(cqRing, cqRingSize);
+        }
+        cqRing = MAP_FAILED;
+        if (sqRing != MAP_FAILED)
+        {
+            ::munmap(sqRing, sqRingSize);
+            sqRing = MAP_FAILED;
+        }
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    // 填好一个请求并放入提交队列（只有本线程生产，尾指针无需原子读）
+    void push(const io_uring_sqe& request)
+    {
+        const unsigned tail = *sqTail;
+        const unsigned index = tail & *sqMask;
+        sqes[index] = request;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++pending;
+    }
+
+    // 提交全部请求并至少等到 wait 个完成
+    void enter(unsigned wait)
+    {
+        while (true)
+        {
+            const int submitted =
+                uringEnter(fd, pending, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0);
+            if (submitted < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+            {
+                continue;
+            }
+            if (submitted < 0)
+            {
+                throw std::runtime_error(std::string("io_uring_enter failed: ") +
+                                         std::strerror(errno));
+            }
+            pending -= static_cast<unsigned>(submitted);
+            return;
+        }
+    }
+};
+
+bool UringCopier::available()
+{
+    static const bool supported = []
+    {
+        try
+        {
+            Ring ring(4);
+            std::vector<unsigned char> buffer(sizeof(io_uring_probe) +
+                                              256 * sizeof(io_uring_probe_op));
+            auto* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+            if (uringRegister(ring.fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+            {
+                return false;
+            }
+            for (const unsigned op : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE,
+                                      IORING_OP_FSYNC, IORING_OP_CLOSE})
+            {
+                if (op > probe->last_op || (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+    }();
+    return supported;
+}
+
+UringCopier::UringCopier(unsigned depth, std::size_t chunkSize, bool fsync)
+    : m_ring(std::make_unique<Ring>(std::max(1u, depth))),
+      m_depth(std::max(1u, depth)),
+      m_chunkSize(std::max<std::size_t>(chunkSize, 4096)),
+      m_fsync(fsync)
+{
+    // 每个文件同时只有一个请求，提交队列不会超过 depth；内核可能把队列长度向上取整
+    m_depth = std::min(m_depth, m_ring->entries);
+}
+
+UringCopier::~UringCopier() = default;
+
+void UringCopier::copy(std::vector<Item>& items)
+{
+    auto& ring = *m_ring;
+    std::vector<Slot> slots(m_depth);
+    std::vector<unsigned> idle;
+    for (unsigned i = m_depth; i > 0; --i)
+    {
+        idle.push_back(i - 1);
+    }
+    std::size_t nextItem = 0;
+    unsigned active = 0;
+
+    auto issue = [&](unsigned index)
+    {
+        auto& slot = slots[index];
+        auto& item = items[slot.item];
+        io_uring_sqe request;
+        std::memset(&request, 0, sizeof(request));
+        request.user_data = index;
+        switch (slot.step)
+        {
+            case Step::OpenSource:
+                request.opcode = IORING_OP_OPENAT;
+                request.fd = AT_FDCWD;
+                request.addr = reinterpret_cast<uint64_t>(item.source.c_str());
+                request.open_flags = O_RDONLY | O_CLOEXEC;
+                break;
+            case Step::OpenTarget:
+                request.opcode = IORING_OP_OPENAT;
+                request.fd = AT_FDCWD;
+                request.addr = reinterpret_cast<uint64_t>(item.dest.c_str());
+                request.len = 0644;
+                request.open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+                break;
+            case Step::Read:
+                request.opcode = IORING_OP_READ;
+                request.fd = slot.source;
+                request.addr = reinterpret_cast<uint64_t>(slot.buffer.data());
+                request.len = static_cast<uint32_t>(slot.buffer.size());
+                request.off = slot.offset;
+                break;
+            case Step::Write:
+                request.opcode = IORING_OP_WRITE;
+                request.fd = slot.target;
+                request.addr = reinterpret_cast<uint64_t>(slot.buffer.data() + slot.written);
+                request.len = static_cast<uint32_t>(slot.length - slot.written);
+                request.off = slot.offset + slot.written;
+                break;
+            case Step::Fsync:
+                request.opcode = IORING_OP_FSYNC;
+                request.fd = slot.target;
+                break;
+            case Step::CloseTarget:
+                request.opcode = IORING_OP_CLOSE;
+                request.fd = slot.target;
+                break;
+            case Step::CloseSource:
+                request.opcode = IORING_OP_CLOSE;
+                request.fd = slot.source;
+                break;
+        }
+        ring.push(request);
+    };
+    auto finish = [&](unsigned index)
+    {
+        auto& slot = slots[index];
+        auto& item = items[slot.item];
+        // 出错时也要结束本次计算，摘要对象留给下一个文件
+        item.hex = item.digest->hexFinal();
+        if (slot.failed)
+        {
+            item.hex.clear();
+        }
+        idle.push_back(index);
+        --active;
+    };
+    // 记录错误并关闭已打开的文件
+    auto fail = [&](unsigned index, const char* what, int error)
+    {
+        auto& slot = slots[index];
+        auto& item = items[slot.item];
+        if (item.error.empty())
+        {
+            item.error = std::string(what) + " " +
+                         (slot.step == Step::OpenSource || slot.step == Step::Read ? item.source
+                                                                                    : item.dest) +
+                         ": " + std::strerror(error);
+        }
+        slot.failed = true;
+        if (slot.target >= 0)
+        {
+            slot.step = Step::CloseTarget;
+        }
+        else if (slot.source >= 0)
+        {
+            slot.step = Step::CloseSource;
+        }
+        else
+        {
+            finish(index);
+            return;
+        }
+        issue(index);
+    };
+    auto advance = [&](unsigned index, int result)
+    {
+        auto& slot = slots[index];
+        auto& item = items[slot.item];
+        if ((result == -EINTR || result == -EAGAIN) && slot.step != Step::CloseTarget &&
+            slot.step != Step::CloseSource)
+        {
+            issue(index);
+            return;
+        }
+        switch (slot.step)
+        {
+            case Step::OpenSource:
+                if (result < 0)
+                {
+                    return fail(index, "cannot open source file", -result);
+                }
+                slot.source = result;
+                slot.step = Step::OpenTarget;
+                break;
+            case Step::OpenTarget:
+                if (result < 0)
+                {
+                    return fail(index, "cannot create target file", -result);
+                }
+                slot.target = result;
+                slot.step = Step::Read;
+                break;
+            case Step::Read:
+                if (result < 0)
+                {
+                    return fail(index, "failed to read source file", -result);
+                }
+                if (result == 0)
+                {
+                    slot.step = m_fsync ? Step::Fsync : Step::CloseTarget;
+                    break;
+                }
+                slot.length = static_cast<std::size_t>(result);
+                slot.written = 0;
+                item.digest->update(slot.buffer.data(), slot.length);
+                if (item.sample != nullptr)
+                {
+                    item.sample->update(slot.buffer.data(), slot.length);
+                }
+                slot.step = Step::Write;
+                break;
+            case Step::Write:
+                if (result <= 0)
+                {
+                    return fail(index, "failed to write target file", result < 0 ? -result : EIO);
+                }
+                slot.written += static_cast<std::size_t>(result);
+                if (slot.written == slot.length)
+                {
+                    slot.offset += slot.length;
+                    slot.step = Step::Read;
+                }
+                break;
+            case Step::Fsync:
+                if (result < 0)
+                {
+                    return fail(index, "failed to sync target file", -result);
+                }
+                slot.step = Step::CloseTarget;
+                break;
+            case Step::CloseTarget:
+                slot.target = -1;
+                if (result < 0 && !slot.failed)
+                {
+                    return fail(index, "failed to write target file", -result);
+                }
+                slot.step = Step::CloseSource;
+                break;
+            case Step::CloseSource:
+                slot.source = -1;
+                return finish(index);
+        }
+        issue(index);
+    };
+
+    while (nextItem < items.size() || active > 0)
+    {
+        while (!idle.empty() && nextItem < items.size())
+        {
+            const auto index = idle.back();
+            idle.pop_back();
+            auto& slot = slots[index];
+            slot.item = nextItem++;
+            slot.step = Step::OpenSource;
+            slot.source = slot.target = -1;
+            slot.offset = 0;
+            slot.length = slot.written = 0;
+            slot.failed = false;
+            slot.buffer.resize(m_chunkSize);
+            items[slot.item].hex.clear();
+            items[slot.item].error.clear();
+            ++active;
+            issue(index);
+        }
+        ring.enter(1);
+        unsigned head = *ring.cqHead;
+        const unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            const auto& completion = ring.cqes[head & *ring.cqMask];
+            const auto index = static_cast<unsigned>(completion.user_data);
+            const int result = completion.res;
+            // 先让出完成队列的位置，处理时提交的新请求不会使其溢出
+            __atomic_store_n(ring.cqHead, head + 1, __ATOMIC_RELEASE);
+            advance(index, result);
+        }
+    }
+}
+#else
+struct UringCopier::Ring
+{
+};
+
+bool UringCopier::available() { return false; }
+
+UringCopier::UringCopier(unsigned depth, std::size_t chunkSize, bool fsync)
+    : m_depth(depth), m_chunkSize(chunkSize), m_fsync(fsync)
+{
+    throw std::runtime_error("io_uring is only available on Linux");
+}
+
+UringCopier::~UringCopier() = default;
+
+void UringCopier::copy(std::vector<Item>&) {}
+#endif
@@ -1,5 +1,29 @@
 #include "util.h"
 
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+#include "hasher.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+// 拷贝时每次读写的块大小
+constexpr std::size_t copyBlockSize = 1 << 20;
+}  // namespace
+
 std::string Utils::replace(std::string str, const std::string& from,
                            const std::string& to)
 {
@@ -14,35 +38,124 @@ std::string Utils::replace(std::string str, const std::string& from,
 
 std::string Utils::getFileMD5(const std::string& filePath)
 {
-    auto u8path = std::filesystem::u8path(filePath);
-    std::ifstream file(u8path, std::ifstream::binary);
-    if (!file)
-    {
-        return "";  // 文件打开失败
-    }
+    return FileHasher::threadLocal().md5(filePath);
+}
 
-    MD5_CTX md5Context;
-    MD5_Init(&md5Context);
+std::string Utils::getFileDigest(const std::string& filePath, const std::string& algorithm)
+{
+    return FileHasher::threadLocal().hash(filePath, algorithm);
+}
 
-    constexpr size_t bufferSize = 4096;
-    char buffer[bufferSize];
-    while (file.good())
+std::string Utils::copyFileWithDigest(const std::string& source, const std::string& dest,
+                                      Digest& digest, Digest* sample)
+{
+    std::ifstream in(std::filesystem::u8path(source), std::ifstream::binary);
+    if (!in)
+    {
+        throw std::runtime_error("cannot open source file: " + source);
+    }
+    std::ofstream out(std::filesystem::u8path(dest),
+                      std::ofstream::binary | std::ofstream::trunc);
+    if (!out)
     {
-        file.read(buffer, bufferSize);
-        MD5_Update(&md5Context, buffer, file.gcount());
+        throw std::runtime_error("cannot create target file: " + dest);
     }
 
-    unsigned char hash[MD5_DIGEST_LENGTH];
-    MD5_Final(hash, &md5Context);
+    // 大块读写，libstdc++/MSVC 对超过流缓冲区的读写直接调用系统接口，不会再经过 4KB 缓冲
+    std::vector<char> buffer(copyBlockSize);
+    while (in)
+    {
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        const auto count = in.gcount();
+        if (count <= 0)
+        {
+            break;
+        }
+        digest.update(buffer.data(), static_cast<std::size_t>(count));
+        if (sample != nullptr)
+        {
+            sample->update(buffer.data(), static_cast<std::size_t>(count));
+        }
+        if (!out.write(buffer.data(), count))
+        {
+            throw std::runtime_error("failed to write target file: " + dest);
+        }
+    }
+    if (in.bad())
+    {
+        throw std::runtime_error("failed to read source file: " + source);
+    }
+    out.close();
+    if (!out)
+    {
+        throw std::runtime_error("failed to write target file: " + dest);
+    }
+    return digest.hexFinal();
+}
 
-    std::stringstream ss;
-    for (const auto& byte : hash)
+std::string Utils::copyFileTailWithDigest(const std::string& source, const std::string& dest,
+                                          uint64_t offset, Digest& prefix, Digest& tail,
+                                          Digest& digest, Digest* sample)
+{
+    std::ifstream in(std::filesystem::u8path(source), std::ifstream::binary);
+    if (!in)
+    {
+        throw std::runtime_error("cannot open source file: " + source);
+    }
+    std::ofstream out(std::filesystem::u8path(dest),
+                      std::ofstream::binary | std::ofstream::trunc);
+    if (!out)
     {
-        ss << std::hex << std::setw(2) << std::setfill('0')
-           << static_cast<int>(byte);
+        throw std::runtime_error("cannot create target file: " + dest);
     }
 
-    return ss.str();
+    std::vector<char> buffer(copyBlockSize);
+    uint64_t position = 0;
+    while (in)
+    {
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        const auto count = static_cast<std::size_t>(std::max<std::streamsize>(in.gcount(), 0));
+        if (count == 0)
+        {
+            break;
+        }
+        digest.update(buffer.data(), count);
+        if (sample != nullptr)
+        {
+            sample->update(buffer.data(), count);
+        }
+        // 本块中属于前 offset 字节的部分
+        const auto head =
+            static_cast<std::size_t>(std::min<uint64_t>(count, offset - std::min(offset, position)));
+        if (head > 0)
+        {
+            prefix.update(buffer.data(), head);
+        }
+        if (count > head)
+        {
+            tail.update(buffer.data() + head, count - head);
+            if (!out.write(buffer.data() + head, static_cast<std::streamsize>(count - head)))
+            {
+                throw std::runtime_error("failed to write target file: " + dest);
+            }
+        }
+        position += count;
+    }
+    if (in.bad())
+    {
+        throw std::runtime_error("failed to read source file: " + source);
+    }
+    if (position < offset)
+    {
+        throw std::runtime_error("source file is shorter than " + std::to_string(offset) +
+                                 " bytes: " + source);
+    }
+    out.close();
+    if (!out)
+    {
+        throw std::runtime_error("failed to write target file: " + dest);
+    }
+    return digest.hexFinal();
 }
 
 std::string Utils::trim(const std::string& str)
@@ -52,3 +165,57 @@ std::string Utils::trim(const std::string& str)
     auto end = str.find_last_not_of(" \t\r\n");
     return str.substr(start, end - start + 1);
 }
+
+void Utils::syncFiles(const std::vector<std::string>& files)
+{
+#if defined(__linux__)
+    std::set<dev_t> synced;
+    for (const auto& file : files)
+    {
+        const int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            continue;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && synced.insert(st.st_dev).second && ::syncfs(fd) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("syncfs failed: " + file);
+        }
+        ::close(fd);
+    }
+#elif defined(_WIN32)
+    for (const auto& file : files)
+    {
+        HANDLE handle = ::CreateFileW(std::filesystem::u8path(file).c_str(), GENERIC_WRITE,
+                                      FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE)
+        {
+            continue;
+        }
+        const bool ok = ::FlushFileBuffers(handle);
+        ::CloseHandle(handle);
+        if (!ok)
+        {
+            throw std::runtime_error("FlushFileBuffers failed: " + file);
+        }
+    }
+#else
+    for (const auto& file : files)
+    {
+        const int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            continue;
+        }
+        const bool ok = ::fsync(fd) == 0;
+        ::close(fd);
+        if (!ok)
+        {
+            throw std::runtime_error("fsync failed: " + file);
+        }
+    }
+#endif
+}
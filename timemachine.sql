@@ -1,3 +1,4 @@
+-- 基础表结构（版本 0）；索引等后续结构变更由程序启动时的迁移完成，见 src/schema_migration.cpp
 -- Disable foreign key checks (SQLite does not support this directly)
 PRAGMA foreign_keys = OFF;
 